@@ -0,0 +1,162 @@
+/*
+*    Huge page backed allocation for the coefficient tables:
+*      1.huge_page_malloc() / huge_page_free():
+*          Blocks of at least HUGE_PAGE_SIZE are mapped with 2 MB pages,
+*          hugetlbfs first, then transparent huge pages (madvise), then
+*          normal pages. Smaller blocks use aligned_malloc().
+*          Large pages on Windows need SeLockMemoryPrivilege, without it
+*          normal pages are used.
+*      2.aligned_malloc() / aligned_free():
+*          64 byte aligned blocks of the C runtime
+*      3.HugePageFree:
+*          Deleter for std::unique_ptr
+*      4.HugePageAllocator:
+*          Allocator for std::vector
+*/
+
+
+#ifndef ALLOCATOR_HPP_
+#define ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+constexpr size_t HUGE_PAGE_SIZE = static_cast<size_t>(2) << 20;
+
+inline void* aligned_malloc(size_t size, size_t alignment)
+{
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size) != 0)
+        return nullptr;
+    return ptr;
+#endif
+}
+
+inline void aligned_free(void* ptr)
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+inline size_t huge_page_round(size_t size)
+{
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+inline void* huge_page_malloc(size_t size)
+{
+    if (size < HUGE_PAGE_SIZE)
+        return aligned_malloc(size, 64);
+
+    size = huge_page_round(size);
+
+#if defined(_WIN32)
+    const size_t large_page = GetLargePageMinimum();
+    if (large_page > 0 && size % large_page == 0)
+    {
+        void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (ptr != nullptr)
+            return ptr;
+    }
+    return VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+#if defined(MAP_HUGETLB)
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+#endif
+
+    // Over-map by one huge page and trim, so the block is 2 MB aligned for THP
+    uint8_t* base = static_cast<uint8_t*>(mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (base == MAP_FAILED)
+        return nullptr;
+
+    uint8_t* aligned = reinterpret_cast<uint8_t*>(huge_page_round(reinterpret_cast<uintptr_t>(base)));
+    if (aligned > base)
+        munmap(base, aligned - base);
+    munmap(aligned + size, base + HUGE_PAGE_SIZE - aligned);
+
+#if defined(MADV_HUGEPAGE)
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+    return aligned;
+#endif
+}
+
+inline void huge_page_free(void* ptr, size_t size)
+{
+    if (ptr == nullptr)
+        return;
+
+    if (size < HUGE_PAGE_SIZE)
+    {
+        aligned_free(ptr);
+        return;
+    }
+
+#if defined(_WIN32)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, huge_page_round(size));
+#endif
+}
+
+struct HugePageFree
+{
+    size_t size = 0;
+
+    void operator()(float* ptr) const noexcept
+    {
+        huge_page_free(ptr, size);
+    }
+};
+
+template<typename T>
+struct HugePageAllocator
+{
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        T* ptr = static_cast<T*>(huge_page_malloc(n * sizeof(T)));
+        if (ptr == nullptr)
+            throw std::bad_alloc{};
+        return ptr;
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        huge_page_free(ptr, n * sizeof(T));
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return true; }
+template<typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) { return false; }
+
+#endif
@@ -0,0 +1,132 @@
+/*
+*    Output conversion:
+*      Maps the fp32 accumulator of the resampling kernel to the samples of
+*      the output format, so bit depth and sample type can be changed without
+*      an extra pass over the frame.
+*
+*      1.PlaneOutput:
+*          Affine transform (out = acc * scale + offset) and clamp range of one plane,
+*          transfer is applied to acc first when resampling in linear light
+*      2.store_row():
+*          Convert a row of accumulators to output samples, with rounding and
+*          optional ordered (16x16 Bayer) or Floyd-Steinberg error diffusion dither
+*          Called in EWAResizer.hpp
+*/
+
+
+#ifndef DITHER_HPP_
+#define DITHER_HPP_
+
+#include <cmath>
+#include <vector>
+#include <type_traits>
+
+#include "Helper.hpp"
+#include "Transfer.hpp"
+
+enum class DitherType
+{
+    None,
+    Ordered,
+    ErrorDiffusion
+};
+
+struct PlaneOutput
+{
+    float scale = 1.f, offset = 0.f;
+    float lower = 0.f, upper = 1.f;
+    DitherType dither = DitherType::None;
+    TransferType transfer = TransferType::None;
+};
+
+// 16x16 Bayer matrix, values 0-255
+static const unsigned char bayer_16x16[16][16] =
+{
+    {   0, 128,  32, 160,   8, 136,  40, 168,   2, 130,  34, 162,  10, 138,  42, 170 },
+    { 192,  64, 224,  96, 200,  72, 232, 104, 194,  66, 226,  98, 202,  74, 234, 106 },
+    {  48, 176,  16, 144,  56, 184,  24, 152,  50, 178,  18, 146,  58, 186,  26, 154 },
+    { 240, 112, 208,  80, 248, 120, 216,  88, 242, 114, 210,  82, 250, 122, 218,  90 },
+    {  12, 140,  44, 172,   4, 132,  36, 164,  14, 142,  46, 174,   6, 134,  38, 166 },
+    { 204,  76, 236, 108, 196,  68, 228, 100, 206,  78, 238, 110, 198,  70, 230, 102 },
+    {  60, 188,  28, 156,  52, 180,  20, 148,  62, 190,  30, 158,  54, 182,  22, 150 },
+    { 252, 124, 220,  92, 244, 116, 212,  84, 254, 126, 222,  94, 246, 118, 214,  86 },
+    {   3, 131,  35, 163,  11, 139,  43, 171,   1, 129,  33, 161,   9, 137,  41, 169 },
+    { 195,  67, 227,  99, 203,  75, 235, 107, 193,  65, 225,  97, 201,  73, 233, 105 },
+    {  51, 179,  19, 147,  59, 187,  27, 155,  49, 177,  17, 145,  57, 185,  25, 153 },
+    { 243, 115, 211,  83, 251, 123, 219,  91, 241, 113, 209,  81, 249, 121, 217,  89 },
+    {  15, 143,  47, 175,   7, 135,  39, 167,  13, 141,  45, 173,   5, 133,  37, 165 },
+    { 207,  79, 239, 111, 199,  71, 231, 103, 205,  77, 237, 109, 197,  69, 229, 101 },
+    {  63, 191,  31, 159,  55, 183,  23, 151,  61, 189,  29, 157,  53, 181,  21, 149 },
+    { 255, 127, 223,  95, 247, 119, 215,  87, 253, 125, 221,  93, 245, 117, 213,  85 }
+};
+
+/* Error rows for Floyd-Steinberg, one element of padding on each side */
+struct DitherState
+{
+    std::vector<float> err_cur, err_next;
+
+    explicit DitherState(int width, DitherType dither)
+    {
+        if (dither == DitherType::ErrorDiffusion)
+        {
+            err_cur.assign(width + 2, 0.f);
+            err_next.assign(width + 2, 0.f);
+        }
+    }
+};
+
+template<typename U>
+void store_row(const float* acc, U* dstp, int width, int y, const PlaneOutput& output, DitherState& state)
+{
+    if constexpr (std::is_floating_point<U>::value)
+    {
+        for (int x = 0; x < width; x++)
+            dstp[x] = static_cast<U>(clamp(acc[x] * output.scale + output.offset, output.lower, output.upper));
+        return;
+    }
+
+    switch (output.dither)
+    {
+    case DitherType::None:
+        for (int x = 0; x < width; x++)
+        {
+            const float value = acc[x] * output.scale + output.offset + 0.5f;
+            dstp[x] = static_cast<U>(clamp(std::floor(value), output.lower, output.upper));
+        }
+        break;
+    case DitherType::Ordered:
+    {
+        const unsigned char* bayer_row = bayer_16x16[y & 15];
+        for (int x = 0; x < width; x++)
+        {
+            const float threshold = (bayer_row[x & 15] + 0.5f) / 256.f;
+            const float value = acc[x] * output.scale + output.offset + threshold;
+            dstp[x] = static_cast<U>(clamp(std::floor(value), output.lower, output.upper));
+        }
+        break;
+    }
+    case DitherType::ErrorDiffusion:
+    {
+        float* err_cur = state.err_cur.data() + 1;
+        float* err_next = state.err_next.data() + 1;
+        for (int x = 0; x < width; x++)
+        {
+            const float value = acc[x] * output.scale + output.offset + err_cur[x];
+            const float quantized = clamp(std::floor(value + 0.5f), output.lower, output.upper);
+            const float error = value - quantized;
+
+            err_cur[x + 1] += error * (7.f / 16.f);
+            err_next[x - 1] += error * (3.f / 16.f);
+            err_next[x] += error * (5.f / 16.f);
+            err_next[x + 1] += error * (1.f / 16.f);
+
+            dstp[x] = static_cast<U>(quantized);
+        }
+        state.err_cur.swap(state.err_next);
+        std::fill(state.err_next.begin(), state.err_next.end(), 0.f);
+        break;
+    }
+    }
+}
+
+#endif
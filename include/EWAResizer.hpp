@@ -11,61 +11,360 @@
 #define EWARESIZER_HPP_
 
 #include <vector>
+#include <string>
 #include <memory>
 
-#include "vapoursynth/VapourSynth.h"
-#include "vapoursynth/VSHelper.h"
-
 #include "Lut.hpp"
+#include "Dither.hpp"
+#include "Allocator.hpp"
 
 struct EWAPixelCoeffMeta
 {
     int start_x, start_y;
-    int coeff_meta;
+    int coeff_meta;     // offset of the block in factor, blocks are multiples of 8 floats so the low bits hold MIRROR_X / MIRROR_Y
 };
 
-struct VSAlignedFree
+// Block of a mirror phase read backwards along x / y, see EWAPixelCoeff::symmetric
+constexpr int MIRROR_X = 1;
+constexpr int MIRROR_Y = 2;
+
+// Handling of windows crossing the frame edge
+enum class BorderMode
 {
-    void operator()(float* ptr) const noexcept
-    {
-        vs_aligned_free(ptr);
-    }
+    Renormalize,    // window is cut at the edge and its coefficients renormalized
+    Replicate,      // source is padded with the edge pixels
+    Mirror          // source is padded with its reflection about the edge pixels
+};
+
+// Position of a coefficient block that still has to be computed
+struct EWACoeffBlock
+{
+    float current_x, current_y;
+    int window_begin_x, window_begin_y;
+};
+
+// EWA window of one output pixel
+struct EWAPixelWindow
+{
+    EWACoeffBlock block;    // unpadded window and the position its coefficients are computed at
+    int phase;              // index in factor_map, -1 for border pixels that need their own coefficients
+};
+
+// One axis of the window, the position along x only depends on the column and along y on the row
+struct EWAAxisWindow
+{
+    int quantized;          // position in units of 1 / quantize
+    int phase;              // quantized modulo quantize
+    int window_begin;       // in the unpadded source
+    bool border;            // the window crosses the edge of an unpadded source
+    float current;          // position the kernel of phase is computed at
+    float exact;            // position the coefficients of a border pixel are computed at
 };
 
+// Coefficients of one output pixel as stored in the table
+struct EWAPixelRead
+{
+    EWACoeffBlock block;    // position the block of phase is computed at
+    int phase;              // block read, the own phase or its mirror, -1 for border pixels
+    int mirror;             // MIRROR_X / MIRROR_Y
+    int start_x, start_y;   // first pixel of the window in the unpadded source
+};
+
+// One axis of EWAPixelRead
+struct EWAAxisRead
+{
+    EWAAxisWindow window;
+    int phase;              // phase or its mirror
+    bool mirror;
+    float current;          // position the block of phase is computed at
+    int window_begin;       // window of that position
+    int start;              // first sample of the window as read
+};
 
 struct EWAPixelCoeff
 {
-    std::unique_ptr<float, VSAlignedFree> factor;
-    std::vector<EWAPixelCoeffMeta> meta;
-    std::vector<int> factor_map;
-    int filter_size = 0, quantize_x = 0, quantize_y = 0, coeff_stride = 0;
+    std::unique_ptr<float, HugePageFree> factor;
+    std::vector<EWAPixelCoeffMeta, HugePageAllocator<EWAPixelCoeffMeta>> meta;
+    std::vector<int, HugePageAllocator<int>> factor_map;
+    // Window is filter_size_x * filter_size_y, each row of a block is padded to coeff_stride
+    int filter_size_x = 0, filter_size_y = 0, quantize_x = 0, quantize_y = 0, coeff_stride = 0;
+
+    // Source position of output pixel (x, y) is (origin_x + x * step_x, origin_y + y * step_y)
+    double origin_x = 0.0, origin_y = 0.0, step_x = 0.0, step_y = 0.0;
+    int src_width = 0, src_height = 0, dst_width = 0, dst_height = 0;
+
+    Lut* func = nullptr;
+    int samples = 0;
+    double radius = 0.0, filter_step_x = 1.0, filter_step_y = 1.0;
+    float filter_support_x = 0.f, filter_support_y = 0.f;
+
+    // Source is read from a plane padded by these amounts, unless border is Renormalize
+    BorderMode border = BorderMode::Renormalize;
+    int pad_left = 0, pad_top = 0, pad_right = 0, pad_bottom = 0;
+
+    // No meta, windows are located and border coefficients computed while resampling
+    bool on_the_fly = false;
+
+    // Same size shift: every interior pixel uses the kernel of this phase, -1 otherwise
+    // Its window begins at (x + constant_offset_x, y + constant_offset_y) of the unpadded source
+    int constant_phase = -1;
+    int constant_offset_x = 0, constant_offset_y = 0;
+
+    // Pixels of [interior_x_begin, interior_x_end) x [interior_y_begin, interior_y_end) need no per-pixel data, they go
+    // through the constant kernel or the phase kernels of a separable table. The others are stored band by band,
+    // see meta_index(). Empty unless constant_phase or separable
+    int interior_x_begin = 0, interior_x_end = 0, interior_y_begin = 0, interior_y_end = 0;
+
+    // Per-frame crops: no meta, so a new crop only costs its window positions, its border blocks and the phase kernels
+    // not found in the table it reuses. Reads of columns and rows are combined while resampling, pixels outside
+    // the interior have their own blocks from border_offset on, in the order of meta_index()
+    bool separable = false;
+    std::vector<EWAAxisRead> columns, rows;
+    int border_offset = 0;
+
+    // The kernel is radially symmetric, so phases past the middle of the quantization grid read the block
+    // of their mirror phase backwards instead of having their own, which stores about a quarter of the blocks
+    bool symmetric = false;
 };
 
-static void init_coeff_table(EWAPixelCoeff* out, int quantize_x, int quantize_y,
-    int filter_size, int dst_width, int dst_height)
+/* Compute one normalized coefficient block, padding columns are zeroed */
+static void compute_coeff_block(Lut* func, float* block, int filter_size_x, int filter_size_y, int coeff_stride, int samples, double radius,
+    double filter_step_x, double filter_step_y, const EWACoeffBlock& pos)
 {
-    out->filter_size = filter_size;
-    out->quantize_x = quantize_x;
-    out->quantize_y = quantize_y;
-    out->coeff_stride = ((filter_size + 7) / 8) * 8;
+    float divider = 0.f;
+
+    // Windowing positon
+    int window_x = pos.window_begin_x;
+    int window_y = pos.window_begin_y;
+
+    // First loop calcuate coeff
+    float* curr_factor_ptr = block;
+
+    const double radius2 = radius * radius;
+    for (int ly = 0; ly < filter_size_y; ly++)
+    {
+        for (int lx = 0; lx < filter_size_x; lx++)
+        {
+            // Euclidean distance to sampling pixel
+            const float dx = (pos.current_x - window_x) * filter_step_x;
+            const float dy = (pos.current_y - window_y) * filter_step_y;
+            const float dist = dx * dx + dy * dy;
+            const int index = static_cast<int>((samples - 1) * dist / radius2 + 0.5);
+
+            const float factor = func->GetFactor(index);
+
+            curr_factor_ptr[lx] = factor;
+            divider += factor;
+
+            window_x++;
+        }
+
+        std::fill(curr_factor_ptr + filter_size_x, curr_factor_ptr + coeff_stride, 0.f);
+        curr_factor_ptr += coeff_stride;
+
+        window_x = pos.window_begin_x;
+        window_y++;
+    }
+
+    // Second loop to divide the coeff
+    curr_factor_ptr = block;
+    for (int ly = 0; ly < filter_size_y; ly++)
+    {
+        for (int lx = 0; lx < filter_size_x; lx++)
+        {
+            curr_factor_ptr[lx] /= divider;
+        }
+
+        curr_factor_ptr += coeff_stride;
+    }
+}
+
+/* Smallest quantization up to max_quantize at which every position start + i * step is exact */
+/* If the scale ratio has no such denominator, max_quantize is used */
+static int auto_quantize(double start, double step, int max_quantize = 256)
+{
+    const auto is_integer = [](double value) { return std::abs(value - std::round(value)) < 1e-6; };
+
+    for (int quantize = 1; quantize < max_quantize; quantize++)
+    {
+        if (is_integer(start * quantize) && is_integer(step * quantize))
+            return quantize;
+    }
+
+    return max_quantize;
+}
+
+/* One axis of the EWA window of an output pixel at source position pos */
+static inline void locate_axis(double pos, int quantize, float filter_support, int filter_size, int src_size, bool padded,
+    EWAAxisWindow* axis)
+{
+    // Quantize pos
+    const int quantized = (int)std::floor(pos * quantize + 0.5);
+    const float quantized_pos = (float)quantized / quantize;
+    bool border = false;
+
+    // Here, the window_*** variable specified a begin/size/end
+    // of EWA window to process.
+    // The window follows the quantized position, so it is aligned with the shared kernels
+    int window_end = (int)std::floor(quantized_pos + filter_support);
+
+    // With a padded source there is no border case, the window may reach into the padding
+    if (!padded && window_end >= src_size)
+    {
+        window_end = src_size - 1;
+        border = true;
+    }
+
+    int window_begin = window_end - filter_size + 1;
+
+    if (!padded && window_begin < 0)
+    {
+        window_begin = 0;
+        border = true;
+    }
 
-    // Allocate metadata
-    out->meta.assign(dst_width * dst_height, EWAPixelCoeffMeta{});
+    axis->quantized = quantized;
+    axis->phase = (quantized % quantize + quantize) % quantize;
+    axis->window_begin = window_begin;
+    axis->border = border;
+    axis->current = padded ? quantized_pos : clamp(quantized_pos, 0.f, src_size - 1.f);
+    axis->exact = clamp((float)pos, 0.f, src_size - 1.f);
+}
+
+static inline void locate_column(const EWAPixelCoeff* coeff, int x, EWAAxisWindow* axis)
+{
+    locate_axis(coeff->origin_x + x * coeff->step_x, coeff->quantize_x, coeff->filter_support_x, coeff->filter_size_x,
+        coeff->src_width, coeff->border != BorderMode::Renormalize, axis);
+}
 
-    // Alocate factor map
-    if (quantize_x > 0 && quantize_y > 0)
-        out->factor_map.assign(quantize_x * quantize_y, 0);
+static inline void locate_row(const EWAPixelCoeff* coeff, int y, EWAAxisWindow* axis)
+{
+    locate_axis(coeff->origin_y + y * coeff->step_y, coeff->quantize_y, coeff->filter_support_y, coeff->filter_size_y,
+        coeff->src_height, coeff->border != BorderMode::Renormalize, axis);
+}
+
+/* EWA window of the output pixel at column ax and row ay */
+static inline void combine_window(const EWAPixelCoeff* coeff, const EWAAxisWindow& ax, const EWAAxisWindow& ay,
+    EWAPixelWindow* window)
+{
+    window->block.window_begin_x = ax.window_begin;
+    window->block.window_begin_y = ay.window_begin;
+
+    // This is the location of current target pixel in source pixel
+    // Quantized, unless the window crosses the edge along either axis
+    if (ax.border || ay.border)
+    {
+        window->phase = -1;
+        window->block.current_x = ax.exact;
+        window->block.current_y = ay.exact;
+    }
     else
-        out->factor_map.clear();
+    {
+        window->phase = ay.phase * coeff->quantize_x + ax.phase;
+        window->block.current_x = ax.current;
+        window->block.current_y = ay.current;
+    }
+}
 
-    // This will be reserved to exact size in coff generating procedure
-    out->factor = nullptr;
+/* Locate the EWA window of output pixel (x, y) */
+static inline void locate_pixel(const EWAPixelCoeff* coeff, int x, int y, EWAPixelWindow* window)
+{
+    EWAAxisWindow ax, ay;
+    locate_column(coeff, x, &ax);
+    locate_row(coeff, y, &ay);
+    combine_window(coeff, ax, ay, window);
 }
 
-/* Coefficient table generation */
-void generate_coeff_table_c(Lut* func, EWAPixelCoeff* out, int quantize_x, int quantize_y,
+/* One axis of the read of an output pixel, samples [lower, upper) are readable */
+/* quantized / quantize = i + phase / quantize, past the middle of the axis the block of mirror_phase = quantize - phase */
+/* is read backwards. The mirrored window can hold one more sample past the support than the own window, on the other */
+/* side, so the own phase is read instead if it would leave the source */
+static inline void read_axis(bool symmetric, const EWAAxisWindow& window, int quantize, float filter_support, int filter_size,
+    int lower, int upper, EWAAxisRead* read)
+{
+    read->window = window;
+    read->phase = window.phase;
+    read->mirror = false;
+    read->current = window.current;
+    read->window_begin = window.window_begin;
+    read->start = window.window_begin;
+
+    if (!symmetric || window.border || 2 * window.phase <= quantize)
+        return;
+
+    // The block of mirror_phase is the one of a position mirror_phase / quantize, with the window it gets in locate_axis()
+    const int mirror_phase = quantize - window.phase;
+    const float current = (float)mirror_phase / quantize;
+    const int window_begin = (int)std::floor(current + filter_support) - filter_size + 1;
+
+    // Read backwards, tap k of the block weights the sample i + 1 - window_begin - k
+    const int i = (window.quantized - window.phase) / quantize;
+    const int start = i + 2 - window_begin - filter_size;
+    if (start < lower || start + filter_size > upper)
+        return;
+
+    read->phase = mirror_phase;
+    read->mirror = true;
+    read->current = current;
+    read->window_begin = window_begin;
+    read->start = start;
+}
+
+/* Reads of every column and row of the output, the read of pixel (x, y) is combine_read() of columns[x] and rows[y] */
+static void locate_reads(const EWAPixelCoeff* coeff, std::vector<EWAAxisRead>* columns, std::vector<EWAAxisRead>* rows)
+{
+    const bool padded = coeff->border != BorderMode::Renormalize;
+
+    columns->resize(coeff->dst_width);
+    for (int x = 0; x < coeff->dst_width; x++)
+    {
+        EWAAxisWindow window;
+        locate_column(coeff, x, &window);
+        read_axis(coeff->symmetric, window, coeff->quantize_x, coeff->filter_support_x, coeff->filter_size_x,
+            padded ? -coeff->pad_left : 0, coeff->src_width + (padded ? coeff->pad_right : 0), &(*columns)[x]);
+    }
+
+    rows->resize(coeff->dst_height);
+    for (int y = 0; y < coeff->dst_height; y++)
+    {
+        EWAAxisWindow window;
+        locate_row(coeff, y, &window);
+        read_axis(coeff->symmetric, window, coeff->quantize_y, coeff->filter_support_y, coeff->filter_size_y,
+            padded ? -coeff->pad_top : 0, coeff->src_height + (padded ? coeff->pad_bottom : 0), &(*rows)[y]);
+    }
+}
+
+/* Block, read direction and window of the output pixel at column rx and row ry */
+static inline void combine_read(const EWAPixelCoeff* coeff, const EWAAxisRead& rx, const EWAAxisRead& ry, EWAPixelRead* read)
+{
+    EWAPixelWindow window;
+    combine_window(coeff, rx.window, ry.window, &window);
+
+    read->block = window.block;
+    read->phase = window.phase;
+    read->mirror = 0;
+    read->start_x = window.block.window_begin_x;
+    read->start_y = window.block.window_begin_y;
+
+    if (window.phase < 0 || !(rx.mirror || ry.mirror))
+        return;
+
+    read->block.current_x = rx.current;
+    read->block.current_y = ry.current;
+    read->block.window_begin_x = rx.window_begin;
+    read->block.window_begin_y = ry.window_begin;
+    read->phase = ry.phase * coeff->quantize_x + rx.phase;
+    read->mirror = (rx.mirror ? MIRROR_X : 0) | (ry.mirror ? MIRROR_Y : 0);
+    read->start_x = rx.start;
+    read->start_y = ry.start;
+}
+
+/* Set up the geometry of a coefficient table, nothing is allocated until build_coeff_table() */
+/* quantize_x / quantize_y <= 0 selects auto_quantize(), on_the_fly takes precedence over separable, padded tables are always separable */
+static void init_coeff_table(EWAPixelCoeff* out, Lut* func, int quantize_x, int quantize_y,
     int samples, int src_width, int src_height, int dst_width, int dst_height, double radius,
-    double crop_left, double crop_top, double crop_width, double crop_height)
+    double crop_left, double crop_top, double crop_width, double crop_height, BorderMode border, bool on_the_fly,
+    bool separable = false)
 {
     const double filter_scale_x = (double)dst_width / crop_width;
     const double filter_scale_y = (double)dst_height / crop_height;
@@ -79,239 +378,819 @@ void generate_coeff_table_c(Lut* func, EWAPixelCoeff* out, int quantize_x, int q
     const int filter_size_x = (int)ceil(filter_support_x * 2.0);
     const int filter_size_y = (int)ceil(filter_support_y * 2.0);
 
-    const float filter_support = std::max(filter_support_x, filter_support_y);
-    const int filter_size = std::max(filter_size_x, filter_size_y);
+    // Positions are computed from integer indices, xpos = start_x + x * x_step, so they don't drift
+    const double start_x = crop_left + (crop_width - dst_width) / (dst_width * 2);
+    const double start_y = crop_top + (crop_height - dst_height) / (dst_height * 2);
 
-    const float start_x = (float)(crop_left + (crop_width - dst_width) / (dst_width * 2));
-    const float start_y = (float)(crop_top + (crop_height - dst_height) / (dst_height * 2));
+    const double x_step = crop_width / dst_width;
+    const double y_step = crop_height / dst_height;
 
-    const float x_step = (float)(crop_width / dst_width);
-    const float y_step = (float)(crop_height / dst_height);
+    if (quantize_x <= 0)
+        quantize_x = auto_quantize(start_x, x_step);
+    if (quantize_y <= 0)
+        quantize_y = auto_quantize(start_y, y_step);
 
-    float xpos = start_x;
-    float ypos = start_y;
+    out->filter_size_x = filter_size_x;
+    out->filter_size_y = filter_size_y;
+    out->quantize_x = quantize_x;
+    out->quantize_y = quantize_y;
+    out->coeff_stride = ((filter_size_x + 7) / 8) * 8;
+
+    out->origin_x = start_x;
+    out->origin_y = start_y;
+    out->step_x = x_step;
+    out->step_y = y_step;
+    out->src_width = src_width;
+    out->src_height = src_height;
+    out->dst_width = dst_width;
+    out->dst_height = dst_height;
+
+    out->func = func;
+    out->samples = samples;
+    out->radius = radius;
+    out->filter_step_x = filter_step_x;
+    out->filter_step_y = filter_step_y;
+    out->filter_support_x = filter_support_x;
+    out->filter_support_y = filter_support_y;
+
+    out->border = border;
+    out->on_the_fly = on_the_fly;
+
+    // Positions grow with x and y, so the first and last pixels give the padding
+    out->pad_left = out->pad_top = out->pad_right = out->pad_bottom = 0;
+    if (border != BorderMode::Renormalize)
+    {
+        EWAPixelWindow first, last;
+        locate_pixel(out, 0, 0, &first);
+        locate_pixel(out, dst_width - 1, dst_height - 1, &last);
+
+        out->pad_left = std::max(0, -first.block.window_begin_x);
+        out->pad_top = std::max(0, -first.block.window_begin_y);
+        out->pad_right = std::max(0, last.block.window_begin_x + filter_size_x - src_width);
+        out->pad_bottom = std::max(0, last.block.window_begin_y + filter_size_y - src_height);
+    }
 
-    // Initialize EWAPixelCoeff data structure
-    init_coeff_table(out, quantize_x, quantize_y, filter_size, dst_width, dst_height);
+    // With a step of exactly one pixel the phase doesn't change, use the kernel of the center pixel
+    out->constant_phase = -1;
+    if (x_step == 1.0 && y_step == 1.0)
+    {
+        EWAPixelWindow center;
+        locate_pixel(out, dst_width / 2, dst_height / 2, &center);
 
-    std::vector<float> tmp_array;
-    int tmp_array_top = 0;
+        if (center.phase >= 0)
+        {
+            out->constant_phase = center.phase;
+            out->constant_offset_x = center.block.window_begin_x - dst_width / 2;
+            out->constant_offset_y = center.block.window_begin_y - dst_height / 2;
+        }
+    }
 
-    // Use to advance the coeff pointer
-    const int coeff_per_pixel = out->coeff_stride * filter_size;
+    out->interior_x_begin = out->interior_x_end = out->interior_y_begin = out->interior_y_end = 0;
+    if (out->constant_phase >= 0)
+    {
+        out->interior_x_end = dst_width;
+        out->interior_y_end = dst_height;
 
-    for (int y = 0; y < dst_height; y++)
+        // Without padding, windows crossing the edge have their own coefficients
+        if (border == BorderMode::Renormalize)
+        {
+            out->interior_x_begin = clamp(-out->constant_offset_x, 0, dst_width);
+            out->interior_y_begin = clamp(-out->constant_offset_y, 0, dst_height);
+            out->interior_x_end = clamp(src_width - filter_size_x + 1 - out->constant_offset_x, out->interior_x_begin, dst_width);
+            out->interior_y_end = clamp(src_height - filter_size_y + 1 - out->constant_offset_y, out->interior_y_begin, dst_height);
+        }
+    }
+
+    // Mirrored blocks are read through the meta or the reads of a separable table, a constant kernel is a single block anyway
+    // On small grids, like those of auto_quantize(), the blocks are a fraction of the meta, so it isn't worth it
+    out->symmetric = !on_the_fly && out->constant_phase < 0 && quantize_x * quantize_y >= 64;
+
+    // Columns and rows whose windows stay inside the source are contiguous, as positions grow with x and y
+    // A padded source has no border pixels, so the table is separable and holds only the phase kernels
+    out->separable = !on_the_fly && (separable || (border != BorderMode::Renormalize && out->constant_phase < 0));
+    out->columns.clear();
+    out->rows.clear();
+    if (out->separable)
     {
-        for (int x = 0; x < dst_width; x++)
+        locate_reads(out, &out->columns, &out->rows);
+
+        auto inside = [](const std::vector<EWAAxisRead>& reads, int* begin, int* end)
         {
-            bool is_border = false;
+            *begin = *end = 0;
+            for (int i = 0; i < static_cast<int>(reads.size()); i++)
+            {
+                if (reads[i].window.border)
+                    continue;
+                if (*begin == *end)
+                    *begin = i;
+                *end = i + 1;
+            }
+        };
+        inside(out->columns, &out->interior_x_begin, &out->interior_x_end);
+        inside(out->rows, &out->interior_y_begin, &out->interior_y_end);
+    }
 
-            EWAPixelCoeffMeta* meta = &out->meta[y * dst_width + x];
+    // Allocated in build_coeff_table()
+    out->meta.clear();
+    out->meta.shrink_to_fit();
+    out->factor_map.clear();
+    out->factor_map.shrink_to_fit();
+    out->factor = nullptr;
+}
+
+/* Per-pixel meta is needed unless windows are located on the fly or separably, or every pixel uses the constant kernel */
+static inline bool uses_meta(const EWAPixelCoeff* coeff)
+{
+    return !coeff->on_the_fly && !coeff->separable && !(coeff->constant_phase >= 0 && coeff->border != BorderMode::Renormalize);
+}
 
-            // Here, the window_*** variable specified a begin/size/end
-            // of EWA window to process.
-            int window_end_x = (int)(xpos + filter_support);
-            int window_end_y = (int)(ypos + filter_support);
+static inline bool in_interior(const EWAPixelCoeff* coeff, int x, int y)
+{
+    return x >= coeff->interior_x_begin && x < coeff->interior_x_end && y >= coeff->interior_y_begin && y < coeff->interior_y_end;
+}
+
+/* Number of meta entries, one per pixel outside the interior */
+static inline size_t meta_count(const EWAPixelCoeff* coeff)
+{
+    return static_cast<size_t>(coeff->dst_width) * coeff->dst_height -
+        static_cast<size_t>(coeff->interior_x_end - coeff->interior_x_begin) * (coeff->interior_y_end - coeff->interior_y_begin);
+}
+
+/* Meta of pixel (x, y) outside the interior: full rows above it, the left and right bands beside it, full rows below it */
+static inline size_t meta_index(const EWAPixelCoeff* coeff, int x, int y)
+{
+    const size_t width = coeff->dst_width;
+    const int y_begin = coeff->interior_y_begin;
+    const int y_end = coeff->interior_y_end;
 
-            if (window_end_x >= src_width)
+    if (y < y_begin || y_begin == y_end)
+        return y * width + x;
+
+    const int interior = coeff->interior_x_end - coeff->interior_x_begin;
+    const size_t band = width - interior;
+    if (y < y_end)
+        return y_begin * width + (y - y_begin) * band + (x < coeff->interior_x_begin ? x : x - interior);
+
+    return y_begin * width + (y_end - y_begin) * band + (y - y_end) * width + x;
+}
+
+/* Interior of a separable table: one column and one row of each phase read along their axis */
+static void interior_phases(const EWAPixelCoeff* coeff, std::vector<int>* columns, std::vector<int>* rows)
+{
+    auto distinct = [](const std::vector<EWAAxisRead>& reads, int begin, int end, int quantize, std::vector<int>* out)
+    {
+        std::vector<char> seen(quantize, 0);
+        out->clear();
+        for (int i = begin; i < end; i++)
+        {
+            if (!seen[reads[i].phase])
             {
-                window_end_x = src_width - 1;
-                is_border = true;
+                seen[reads[i].phase] = 1;
+                out->push_back(i);
             }
-            if (window_end_y >= src_height)
+        }
+    };
+
+    distinct(coeff->columns, coeff->interior_x_begin, coeff->interior_x_end, coeff->quantize_x, columns);
+    distinct(coeff->rows, coeff->interior_y_begin, coeff->interior_y_end, coeff->quantize_y, rows);
+}
+
+/* Size in bytes the coefficient table will take once built */
+static size_t plan_coeff_table(const EWAPixelCoeff* coeff)
+{
+    std::vector<char> seen(static_cast<size_t>(coeff->quantize_x) * coeff->quantize_y, 0);
+    size_t blocks = 0;
+
+    // Kernels of the interior, whose pixels are skipped
+    if (coeff->separable)
+    {
+        std::vector<int> phase_columns, phase_rows;
+        interior_phases(coeff, &phase_columns, &phase_rows);
+        blocks += phase_columns.size() * phase_rows.size();
+    }
+    else if (coeff->constant_phase >= 0)
+    {
+        seen[coeff->constant_phase] = 1;
+        blocks++;
+    }
+
+    std::vector<EWAAxisRead> located_columns, located_rows;
+    if (!coeff->separable)
+        locate_reads(coeff, &located_columns, &located_rows);
+    const std::vector<EWAAxisRead>& columns = coeff->separable ? coeff->columns : located_columns;
+    const std::vector<EWAAxisRead>& rows = coeff->separable ? coeff->rows : located_rows;
+
+    for (int y = 0; y < coeff->dst_height; y++)
+    {
+        for (int x = 0; x < coeff->dst_width; x++)
+        {
+            // Skip the rest of the interior span of the row
+            if (in_interior(coeff, x, y))
             {
-                window_end_y = src_height - 1;
-                is_border = true;
+                x = coeff->interior_x_end - 1;
+                continue;
             }
 
-            int window_begin_x = window_end_x - filter_size + 1;
-            int window_begin_y = window_end_y - filter_size + 1;
+            EWAPixelRead read;
+            combine_read(coeff, columns[x], rows[y], &read);
 
-            if (window_begin_x < 0)
+            if (read.phase < 0)
             {
-                window_begin_x = 0;
-                is_border = true;
+                // Border coefficients are computed while resampling on the fly
+                if (!coeff->on_the_fly)
+                    blocks++;
             }
-            if (window_begin_y < 0)
+            else if (!seen[read.phase])
             {
-                window_begin_y = 0;
-                is_border = true;
+                seen[read.phase] = 1;
+                blocks++;
             }
+        }
+    }
+
+    size_t size = blocks * coeff->coeff_stride * coeff->filter_size_y * sizeof(float);
+    size += seen.size() * sizeof(int);
+    if (uses_meta(coeff))
+        size += meta_count(coeff) * sizeof(EWAPixelCoeffMeta);
+    if (coeff->separable)
+        size += (columns.size() + rows.size()) * sizeof(EWAAxisRead);
 
-            meta->start_x = window_begin_x;
-            meta->start_y = window_begin_y;
+    return size;
+}
 
-            // Quantize xpos and ypos
-            const int quantized_x_int = (int)((double)xpos * quantize_x + 0.5);
-            const int quantized_y_int = (int)((double)ypos * quantize_y + 0.5);
-            const int quantized_x_value = quantized_x_int % quantize_x;
-            const int quantized_y_value = quantized_y_int % quantize_y;
-            const float quantized_xpos = (float)quantized_x_int / quantize_x;
-            const float quantized_ypos = (float)quantized_y_int / quantize_y;
+/* Phase kernels of two tables are interchangeable if they sample the same filter at the same step and quantization */
+static bool same_phase_kernels(const EWAPixelCoeff* a, const EWAPixelCoeff* b)
+{
+    return a->func == b->func && a->samples == b->samples && a->radius == b->radius &&
+        a->filter_step_x == b->filter_step_x && a->filter_step_y == b->filter_step_y &&
+        a->filter_size_x == b->filter_size_x && a->filter_size_y == b->filter_size_y &&
+        a->quantize_x == b->quantize_x && a->quantize_y == b->quantize_y;
+}
 
-            if (!is_border && out->factor_map[quantized_y_value * quantize_x + quantized_x_value] != 0)
+/* Phase (b, a) of phase (a, b), the grid is square */
+static inline int transposed_phase(const EWAPixelCoeff* coeff, int phase)
+{
+    return (phase % coeff->quantize_x) * coeff->quantize_x + phase / coeff->quantize_x;
+}
+
+/* Transpose of a filter_size x filter_size block, padding columns are zeroed */
+static void transpose_block(const float* src, float* dst, int filter_size, int coeff_stride)
+{
+    for (int ly = 0; ly < filter_size; ly++)
+    {
+        for (int lx = 0; lx < filter_size; lx++)
+            dst[ly * coeff_stride + lx] = src[lx * coeff_stride + ly];
+
+        std::fill(dst + ly * coeff_stride + filter_size, dst + (ly + 1) * coeff_stride, 0.f);
+    }
+}
+
+/* Coefficient table generation */
+/* Phase kernels already present in reuse are copied instead of computed, see same_phase_kernels() */
+/* With symmetric, only the blocks of the first half of each axis are built, plus those of pixels whose mirrored window */
+/* leaves the source, and square grids get half of them by transposition */
+/* A separable table only computes the kernels of its interior and the blocks of the pixels outside it */
+static void build_coeff_table(EWAPixelCoeff* out, const EWAPixelCoeff* reuse = nullptr)
+{
+    const int quantize_x = out->quantize_x;
+    const int quantize_y = out->quantize_y;
+    const int dst_width = out->dst_width;
+    const int dst_height = out->dst_height;
+
+    const bool store_meta = uses_meta(out);
+    if (store_meta)
+        out->meta.assign(meta_count(out), EWAPixelCoeffMeta{});
+    out->factor_map.assign(static_cast<size_t>(quantize_x) * quantize_y, 0);
+
+    // First pass assigns an offset in factor to each pixel and records the blocks to compute,
+    // so factor can be allocated to its exact size without an intermediate copy
+    std::vector<EWACoeffBlock> blocks;
+    std::vector<int> block_phase;
+    int factor_top = 0;
+
+    // Use to advance the coeff pointer
+    const int coeff_per_pixel = out->coeff_stride * out->filter_size_y;
+
+    // Kernels of the interior come first, interior pixels don't need anything else
+    if (out->separable)
+    {
+        std::vector<int> phase_columns, phase_rows;
+        interior_phases(out, &phase_columns, &phase_rows);
+
+        for (int y : phase_rows)
+        {
+            for (int x : phase_columns)
+            {
+                const EWAAxisRead& rx = out->columns[x];
+                const EWAAxisRead& ry = out->rows[y];
+                const int phase = ry.phase * quantize_x + rx.phase;
+
+                blocks.push_back(EWACoeffBlock{ rx.current, ry.current, rx.window_begin, ry.window_begin });
+                block_phase.push_back(phase);
+                out->factor_map[phase] = factor_top + 1;
+                factor_top += coeff_per_pixel;
+            }
+        }
+    }
+    else if (out->constant_phase >= 0)
+    {
+        EWAPixelWindow center;
+        locate_pixel(out, dst_width / 2, dst_height / 2, &center);
+
+        blocks.push_back(center.block);
+        block_phase.push_back(center.phase);
+        out->factor_map[center.phase] = factor_top + 1;
+        factor_top += coeff_per_pixel;
+    }
+
+    // Outside the interior of a separable table every window crosses the edge, so each pixel gets its own block in turn
+    out->border_offset = factor_top;
+
+    std::vector<EWAAxisRead> located_columns, located_rows;
+    if (!out->separable)
+        locate_reads(out, &located_columns, &located_rows);
+    const std::vector<EWAAxisRead>& columns = out->separable ? out->columns : located_columns;
+    const std::vector<EWAAxisRead>& rows = out->separable ? out->rows : located_rows;
+
+    for (int y = 0; y < dst_height; y++)
+    {
+        for (int x = 0; x < dst_width; x++)
+        {
+            // Skip the rest of the interior span of the row
+            if (in_interior(out, x, y))
+            {
+                x = out->interior_x_end - 1;
+                continue;
+            }
+
+            EWAPixelRead read;
+            combine_read(out, columns[x], rows[y], &read);
+
+            int coeff_meta;
+
+            if (read.phase >= 0 && out->factor_map[read.phase] != 0)
             {
                 // Not border pixel and already have coefficient calculated at this quantized position
-                meta->coeff_meta = out->factor_map[quantized_y_value * quantize_x + quantized_x_value] - 1;
+                coeff_meta = out->factor_map[read.phase] - 1;
+            }
+            else if (read.phase < 0 && out->on_the_fly)
+            {
+                // Computed while resampling
+                continue;
             }
             else
             {
                 // then need computation
-                float divider = 0.f;
+                blocks.push_back(read.block);
+                block_phase.push_back(read.phase);
 
-                // This is the location of current target pixel in source pixel
-                // Quantized
-                const float current_x = clamp(is_border ? xpos : quantized_xpos, 0.f, src_width - 1.f);
-                const float current_y = clamp(is_border ? ypos : quantized_ypos, 0.f, src_height - 1.f);
+                // Save factor to table
+                if (read.phase >= 0)
+                    out->factor_map[read.phase] = factor_top + 1;
 
-                if (!is_border)
-                {
-                    // Change window position to quantized position
-                    window_begin_x = (int)(quantized_xpos + filter_support) - filter_size + 1;
-                    window_begin_y = (int)(quantized_ypos + filter_support) - filter_size + 1;
-                }
+                coeff_meta = factor_top;
+                factor_top += coeff_per_pixel;
+            }
 
-                // Windowing positon
-                int window_x = window_begin_x;
-                int window_y = window_begin_y;
+            if (store_meta)
+            {
+                EWAPixelCoeffMeta* meta = &out->meta[meta_index(out, x, y)];
+                meta->start_x = read.start_x + out->pad_left;
+                meta->start_y = read.start_y + out->pad_top;
+                meta->coeff_meta = coeff_meta | read.mirror;
+            }
+        }
+    }
 
-                // First loop calcuate coeff
-                tmp_array.resize(tmp_array.size() + coeff_per_pixel, 0.f);
-                int curr_factor_ptr = tmp_array_top;
+    // Second pass computes the coefficients in place
+    const size_t factor_size = static_cast<size_t>(factor_top) * sizeof(float);
+    out->factor = std::unique_ptr<float, HugePageFree>(static_cast<float*>(huge_page_malloc(factor_size)), HugePageFree{ factor_size });
+    if (out->factor == nullptr && factor_size > 0)
+        throw std::string{ "failed to allocate " + std::to_string(factor_size >> 20) + " MB of coefficient tables, lower max_memory" };
 
-                const double radius2 = radius * radius;
-                for (int ly = 0; ly < filter_size; ly++)
-                {
-                    for (int lx = 0; lx < filter_size; lx++)
-                    {
-                        // Euclidean distance to sampling pixel
-                        const float dx = (current_x - window_x) * filter_step_x;
-                        const float dy = (current_y - window_y) * filter_step_y;
-                        const float dist = dx * dx + dy * dy;
-                        const int index = static_cast<int>(std::round((samples - 1) * dist / radius2));
+    if (reuse != nullptr && !same_phase_kernels(out, reuse))
+        reuse = nullptr;
 
-                        const float factor = func->GetFactor(index);
+    // With the same filter along x and y, the block of phase (a, b) is the transpose of the one of (b, a)
+    const bool transposable = out->symmetric && quantize_x == quantize_y && out->filter_size_x == out->filter_size_y &&
+        out->filter_step_x == out->filter_step_y;
+    std::vector<char> built(transposable ? static_cast<size_t>(quantize_x) * quantize_y : 0, 0);
 
-                        tmp_array[curr_factor_ptr + lx] = factor;
-                        divider += factor;
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        float* block = out->factor.get() + i * coeff_per_pixel;
+        const int phase = block_phase[i];
 
-                        window_x++;
-                    }
+        if (reuse != nullptr && phase >= 0 && reuse->factor_map[phase] != 0)
+        {
+            const float* reuse_block = reuse->factor.get() + reuse->factor_map[phase] - 1;
+            std::copy(reuse_block, reuse_block + coeff_per_pixel, block);
+        }
+        else if (transposable && phase >= 0 && built[transposed_phase(out, phase)])
+        {
+            const float* other = out->factor.get() + out->factor_map[transposed_phase(out, phase)] - 1;
+            transpose_block(other, block, out->filter_size_x, out->coeff_stride);
+        }
+        else
+        {
+            compute_coeff_block(out->func, block, out->filter_size_x, out->filter_size_y, out->coeff_stride,
+                out->samples, out->radius, out->filter_step_x, out->filter_step_y, blocks[i]);
+        }
 
-                    curr_factor_ptr += out->coeff_stride;
+        if (transposable && phase >= 0)
+            built[phase] = 1;
+    }
+}
 
-                    window_x = window_begin_x;
-                    window_y++;
-                }
+inline void generate_coeff_table_c(Lut* func, EWAPixelCoeff* out, int quantize_x, int quantize_y,
+    int samples, int src_width, int src_height, int dst_width, int dst_height, double radius,
+    double crop_left, double crop_top, double crop_width, double crop_height, BorderMode border)
+{
+    init_coeff_table(out, func, quantize_x, quantize_y, samples, src_width, src_height, dst_width, dst_height, radius,
+        crop_left, crop_top, crop_width, crop_height, border, false);
+    build_coeff_table(out);
+}
 
-                // Second loop to divide the coeff
-                curr_factor_ptr = tmp_array_top;
-                for (int ly = 0; ly < filter_size; ly++)
-                {
-                    for (int lx = 0; lx < filter_size; lx++)
-                    {
-                        tmp_array[curr_factor_ptr + lx] /= divider;
-                    }
+/* Index of a padding sample inside [0, size) */
+inline int border_index(int i, int size, BorderMode border)
+{
+    if (border == BorderMode::Replicate || size == 1)
+        return clamp(i, 0, size - 1);
 
-                    curr_factor_ptr += out->coeff_stride;
-                }
+    const int period = 2 * (size - 1);
+    i = std::abs(i) % period;
+    return i < size ? i : period - i;
+}
 
-                // Save factor to table
-                if (!is_border)
-                    out->factor_map[quantized_y_value * quantize_x + quantized_x_value] = tmp_array_top + 1;
+/* Source sample loaders */
+template<typename T>
+struct DirectLoad
+{
+    float operator()(T value) const { return value; }
+};
 
-                meta->coeff_meta = tmp_array_top;
-                tmp_array_top += coeff_per_pixel;
-            }
+/* Integer samples through a per-code lut, e.g. to linear light */
+template<typename T>
+struct LutLoad
+{
+    const float* lut;
+    float operator()(T value) const { return lut[value]; }
+};
 
-            xpos += x_step;
-        }
+/* Float samples to linear light */
+struct TransferLoad
+{
+    TransferType transfer;
+    float operator()(float value) const { return static_cast<float>(to_linear(value, transfer)); }
+};
+
+/* Copy source rows [row_begin, row_end) into dstp through load, with the padding of coeff */
+/* Rows count from the first row of the unpadded source, those of the padding are negative or past src_height */
+template<typename T, typename D, typename Load>
+void pad_rows(const EWAPixelCoeff* coeff, const T* srcp, int src_stride, D* dstp, int dst_stride, int row_begin, int row_end,
+    const Load& load)
+{
+    const int width = coeff->src_width;
+    const int height = coeff->src_height;
+
+    for (int y = row_begin; y < row_end; y++)
+    {
+        const T* src_row = srcp + border_index(y, height, coeff->border) * src_stride;
+        D* dst_row = dstp + (y - row_begin) * dst_stride + coeff->pad_left;
+
+        for (int x = -coeff->pad_left; x < 0; x++)
+            dst_row[x] = load(src_row[border_index(x, width, coeff->border)]);
 
-        ypos += y_step;
-        xpos = start_x;
+        for (int x = 0; x < width; x++)
+            dst_row[x] = load(src_row[x]);
+
+        for (int x = width; x < width + coeff->pad_right; x++)
+            dst_row[x] = load(src_row[border_index(x, width, coeff->border)]);
     }
+}
+
+/* Source rows [*first, *last) read by output rows [row_begin, row_end), counted as in pad_rows() */
+/* Windows move down with y, so the first and last output rows bound them */
+static void source_rows(const EWAPixelCoeff* coeff, int row_begin, int row_end, bool antiring, int* first, int* last)
+{
+    EWAAxisWindow top, bottom;
+    locate_row(coeff, row_begin, &top);
+    locate_row(coeff, row_end - 1, &bottom);
+
+    // A mirrored read may start one row above or end one row below its window
+    *first = top.window_begin - 1;
+    *last = bottom.window_begin + coeff->filter_size_y + 1;
 
-    // Copy from tmp_array to real array
-    const int tmp_array_size = tmp_array.size();
-    out->factor.reset(static_cast<float*>(vs_aligned_malloc(tmp_array_size * sizeof(float), 64))); // aligned to cache line
-    std::copy(tmp_array.begin(), tmp_array.end(), out->factor.get());
+    // Anti-ringing reads up to 1 / filter_step rows around the position
+    if (antiring)
+    {
+        const double reach = 1.0 / coeff->filter_step_y;
+        *first = std::min(*first, (int)std::floor(coeff->origin_y + row_begin * coeff->step_y - reach));
+        *last = std::max(*last, (int)std::floor(coeff->origin_y + (row_end - 1) * coeff->step_y + reach) + 2);
+    }
+
+    *first = clamp(*first, -coeff->pad_top, coeff->src_height + coeff->pad_bottom);
+    *last = clamp(*last, *first, coeff->src_height + coeff->pad_bottom);
 }
 
-/* Planar resampling with coeff table */
-/* 8-16 bit */
-//#pragma intel optimization_parameter target_arch=sse
+/* Anti-ringing: pull result toward the range of the source pixels nearest to (xpos, ypos) */
+/* That is the nearest 2x2 when upscaling, an axis being downscaled spans reach = 1 / filter_step samples on each side, */
+/* the area one output pixel covers, so the clamp doesn't throw away what the filter averages */
+template<typename T, typename Load>
+inline float limit_ringing(float result, const T* srcp, int src_stride, int src_width, int src_height,
+    float xpos, float ypos, float reach_x, float reach_y, float strength, const Load& load)
+{
+    const int x0 = clamp((int)std::floor(xpos - (reach_x - 1.f)), 0, src_width - 1);
+    const int y0 = clamp((int)std::floor(ypos - (reach_y - 1.f)), 0, src_height - 1);
+    const int x1 = std::min(std::max((int)std::floor(xpos + reach_x), x0 + 1), src_width - 1);
+    const int y1 = std::min(std::max((int)std::floor(ypos + reach_y), y0 + 1), src_height - 1);
+
+    float local_min = load(srcp[y0 * src_stride + x0]);
+    float local_max = local_min;
+    for (int y = y0; y <= y1; y++)
+    {
+        const T* src_row = srcp + y * src_stride;
+        for (int x = x0; x <= x1; x++)
+        {
+            const float p = load(src_row[x]);
+            local_min = std::min(local_min, p);
+            local_max = std::max(local_max, p);
+        }
+    }
+
+    return result + strength * (clamp(result, local_min, local_max) - result);
+}
+
+/* Source window and coefficients of output pixel (x, y) */
+/* border_block receives the coefficients of border pixels when they are computed on the fly */
+/* Rows of coefficients are coeff_step apart, and read backwards if reverse, see EWAPixelCoeff::symmetric */
 template<typename T>
-void resize_plane_c(EWAPixelCoeff* coeff, const T* srcp, T* VS_RESTRICT dstp,
-    int dst_width, int dst_height, int src_stride, int dst_stride, int peak)
+inline void locate_coeff(const EWAPixelCoeff* coeff, const T* srcp, int src_stride, int x, int y, float* border_block,
+    const T** src_ptr, const float** coeff_ptr, int* coeff_step, bool* reverse)
 {
-    EWAPixelCoeffMeta* meta = coeff->meta.data();
+    *coeff_step = coeff->coeff_stride;
+    *reverse = false;
+    int mirror = 0;
 
-    for (int y = 0; y < dst_height; y++)
+    if (coeff->on_the_fly)
     {
-        for (int x = 0; x < dst_width; x++)
+        EWAPixelWindow window;
+        locate_pixel(coeff, x, y, &window);
+
+        *src_ptr = srcp + (window.block.window_begin_y + coeff->pad_top) * src_stride + window.block.window_begin_x + coeff->pad_left;
+        if (window.phase >= 0)
         {
-            const T* src_ptr = srcp + meta->start_y * src_stride + meta->start_x;
-            const float* coeff_ptr = coeff->factor.get() + meta->coeff_meta;
+            *coeff_ptr = coeff->factor.get() + coeff->factor_map[window.phase] - 1;
+        }
+        else
+        {
+            compute_coeff_block(coeff->func, border_block, coeff->filter_size_x, coeff->filter_size_y, coeff->coeff_stride,
+                coeff->samples, coeff->radius, coeff->filter_step_x, coeff->filter_step_y, window.block);
+            *coeff_ptr = border_block;
+        }
+    }
+    else if (coeff->separable)
+    {
+        const EWAAxisRead& rx = coeff->columns[x];
+        const EWAAxisRead& ry = coeff->rows[y];
 
-            float result = 0.f;
-            for (int ly = 0; ly < coeff->filter_size; ly++)
-            {
-                for (int lx = 0; lx < coeff->filter_size; lx++)
-                {
-                    result += src_ptr[lx] * coeff_ptr[lx];
-                }
-                coeff_ptr += coeff->coeff_stride;
-                src_ptr += src_stride;
-            }
+        if (in_interior(coeff, x, y))
+        {
+            *src_ptr = srcp + (ry.start + coeff->pad_top) * src_stride + rx.start + coeff->pad_left;
+            *coeff_ptr = coeff->factor.get() + coeff->factor_map[ry.phase * coeff->quantize_x + rx.phase] - 1;
+            mirror = (rx.mirror ? MIRROR_X : 0) | (ry.mirror ? MIRROR_Y : 0);
+        }
+        else
+        {
+            *src_ptr = srcp + (ry.window.window_begin + coeff->pad_top) * src_stride + rx.window.window_begin + coeff->pad_left;
+            *coeff_ptr = coeff->factor.get() + coeff->border_offset +
+                meta_index(coeff, x, y) * static_cast<size_t>(coeff->coeff_stride) * coeff->filter_size_y;
+        }
+    }
+    else
+    {
+        const EWAPixelCoeffMeta* meta = coeff->meta.data() + meta_index(coeff, x, y);
+        *src_ptr = srcp + meta->start_y * src_stride + meta->start_x;
+        *coeff_ptr = coeff->factor.get() + (meta->coeff_meta & ~(MIRROR_X | MIRROR_Y));
+        mirror = meta->coeff_meta & (MIRROR_X | MIRROR_Y);
+    }
 
-            dstp[x] = static_cast<T>(clamp(result, 0.f, (float)peak));
+    // Mirrored blocks are read from their last row / column
+    if (mirror & MIRROR_Y)
+    {
+        *coeff_ptr += (coeff->filter_size_y - 1) * coeff->coeff_stride;
+        *coeff_step = -coeff->coeff_stride;
+    }
+    if (mirror & MIRROR_X)
+    {
+        *coeff_ptr += coeff->filter_size_x - 1;
+        *reverse = true;
+    }
+}
 
-            meta++;
+/* Weighted sum of one window, coefficients are read backwards along x if Reverse */
+template<bool Reverse, typename T, typename Load>
+inline float apply_coeff(const T* src_ptr, const float* coeff_ptr, int filter_size_x, int filter_size_y, int coeff_stride, int src_stride,
+    const Load& load)
+{
+    float result = 0.f;
+    for (int ly = 0; ly < filter_size_y; ly++)
+    {
+        for (int lx = 0; lx < filter_size_x; lx++)
+        {
+            result += load(src_ptr[lx]) * coeff_ptr[Reverse ? -lx : lx];
         }
+        coeff_ptr += coeff_stride;
+        src_ptr += src_stride;
+    }
+    return result;
+}
 
-        dstp += dst_stride;
+/* Most frames resampled in one traversal of the tables */
+constexpr int MAX_BATCH = 16;
+
+/* Weighted sums of the same window in N frames */
+/* Frames are the inner loop, so each coefficient is loaded once and the N sums are independent */
+template<int N, bool Reverse, typename T, typename Load>
+inline void apply_coeff_frames(const T* const* srcps, ptrdiff_t offset, const float* coeff_ptr,
+    int filter_size_x, int filter_size_y, int coeff_stride, int src_stride, float* results, const Load& load)
+{
+    const T* src[N];
+    float acc[N];
+    for (int f = 0; f < N; f++)
+    {
+        src[f] = srcps[f] + offset;
+        acc[f] = 0.f;
+    }
+
+    for (int ly = 0; ly < filter_size_y; ly++)
+    {
+        for (int lx = 0; lx < filter_size_x; lx++)
+        {
+            const float weight = coeff_ptr[Reverse ? -lx : lx];
+            for (int f = 0; f < N; f++)
+                acc[f] += load(src[f][lx]) * weight;
+        }
+        coeff_ptr += coeff_stride;
+        for (int f = 0; f < N; f++)
+            src[f] += src_stride;
+    }
+
+    for (int f = 0; f < N; f++)
+        results[f] = acc[f];
+}
+
+/* Weighted sums of the same window in frames frames */
+template<bool Reverse, typename T, typename Load>
+inline void apply_coeff_batch(const T* const* srcps, int frames, ptrdiff_t offset, const float* coeff_ptr,
+    int filter_size_x, int filter_size_y, int coeff_step, int src_stride, float* results, const Load& load)
+{
+    // Frames go in pairs, two independent sums hide the latency of the adds,
+    // and the coefficients loaded by the first pair stay in L1 for the others
+    int f = 0;
+    for (; f + 2 <= frames; f += 2)
+        apply_coeff_frames<2, Reverse>(srcps + f, offset, coeff_ptr, filter_size_x, filter_size_y, coeff_step, src_stride,
+            results + f, load);
+    for (; f < frames; f++)
+        results[f] = apply_coeff<Reverse>(srcps[f] + offset, coeff_ptr, filter_size_x, filter_size_y, coeff_step, src_stride, load);
+}
+
+/* Convolution of the interior of a same size shift, all pixels share one kernel */
+/* The rows are accumulated tap by tap, so the weight stays in a register and x is vectorized */
+template<typename T, typename Load>
+void convolve_row_constant(const EWAPixelCoeff* coeff, const T* srcp, int src_stride, int y, int x_begin, int x_end,
+    float* JINC_RESTRICT row, const Load& load)
+{
+    const float* kernel = coeff->factor.get() + coeff->factor_map[coeff->constant_phase] - 1;
+    const T* src_row = srcp + (y + coeff->constant_offset_y + coeff->pad_top) * src_stride +
+        coeff->constant_offset_x + coeff->pad_left;
+
+    std::fill(row + x_begin, row + x_end, 0.f);
+
+    for (int ly = 0; ly < coeff->filter_size_y; ly++)
+    {
+        for (int lx = 0; lx < coeff->filter_size_x; lx++)
+        {
+            const float weight = kernel[lx];
+            const T* src_ptr = src_row + lx;
+
+            for (int x = x_begin; x < x_end; x++)
+                row[x] += load(src_ptr[x]) * weight;
+        }
+        kernel += coeff->coeff_stride;
+        src_row += src_stride;
     }
 }
 
 /* Planar resampling with coeff table */
-/* 32 bit */
-void resize_plane_c(EWAPixelCoeff* coeff, const float* srcp, float* VS_RESTRICT dstp,
-    int dst_width, int dst_height, int src_stride, int dst_stride)
+/* 8-16 bit and 32 bit input, written to the output format described by PlaneOutput */
+/* The same plane of up to MAX_BATCH frames, all with the same strides, each coefficient is loaded once for all of them */
+/* Only rows [row_begin, row_end) are written, so a plane can be split among threads unless it is error diffused */
+/* An error diffused plane resampled in several calls passes dither_states, one per frame, so the error carries over */
+//#pragma intel optimization_parameter target_arch=sse
+template<typename T, typename U, typename Load>
+void resize_planes_c(EWAPixelCoeff* coeff, const T* const* srcps, U* const* dstps, int frames,
+    int dst_width, int dst_height, int row_begin, int row_end, int src_stride, int dst_stride, const PlaneOutput& output,
+    float antiring, const Load& load, std::vector<DitherState>* dither_states = nullptr)
 {
-    EWAPixelCoeffMeta* meta = coeff->meta.data();
+    std::vector<float> rows(static_cast<size_t>(frames) * dst_width);
 
-    for (int y = 0; y < dst_height; y++)
+    std::vector<DitherState> local_states;
+    if (dither_states == nullptr)
     {
-        for (int x = 0; x < dst_width; x++)
+        local_states.assign(frames, DitherState(dst_width, output.dither));
+        dither_states = &local_states;
+    }
+
+    // Coefficients of border pixels when the table is built on the fly
+    std::vector<float> border_block;
+    if (coeff->on_the_fly)
+        border_block.resize(static_cast<size_t>(coeff->coeff_stride) * coeff->filter_size_y);
+
+    // Pixels of the interior go through the constant kernel if there is one, others through the table
+    const int x_begin = coeff->interior_x_begin, x_end = coeff->interior_x_end;
+    const int y_begin = coeff->interior_y_begin, y_end = coeff->interior_y_end;
+
+    for (int y = row_begin; y < row_end; y++)
+    {
+        auto table_pixels = [&](int from, int to)
         {
-            const float* src_ptr = srcp + meta->start_y * src_stride + meta->start_x;
-            const float* coeff_ptr = coeff->factor.get() + meta->coeff_meta;
+            for (int x = from; x < to; x++)
+            {
+                const T* src_ptr;
+                const float* coeff_ptr;
+                int coeff_step;
+                bool reverse;
+                locate_coeff(coeff, srcps[0], src_stride, x, y, border_block.data(), &src_ptr, &coeff_ptr, &coeff_step, &reverse);
+
+                const ptrdiff_t offset = src_ptr - srcps[0];
+                float results[MAX_BATCH];
+                if (reverse)
+                    apply_coeff_batch<true>(srcps, frames, offset, coeff_ptr, coeff->filter_size_x, coeff->filter_size_y,
+                        coeff_step, src_stride, results, load);
+                else
+                    apply_coeff_batch<false>(srcps, frames, offset, coeff_ptr, coeff->filter_size_x, coeff->filter_size_y,
+                        coeff_step, src_stride, results, load);
+
+                for (int f = 0; f < frames; f++)
+                    rows[f * dst_width + x] = results[f];
+            }
+        };
 
-            float result = 0.f;
-            for (int ly = 0; ly < coeff->filter_size; ly++)
+        if (coeff->constant_phase >= 0 && y >= y_begin && y < y_end && x_begin < x_end)
+        {
+            for (int f = 0; f < frames; f++)
+                convolve_row_constant(coeff, srcps[f], src_stride, y, x_begin, x_end, rows.data() + f * dst_width, load);
+            table_pixels(0, x_begin);
+            table_pixels(x_end, dst_width);
+        }
+        else
+        {
+            table_pixels(0, dst_width);
+        }
+
+        for (int f = 0; f < frames; f++)
+        {
+            float* row = rows.data() + f * dst_width;
+
+            if (antiring > 0.f)
             {
-                for (int lx = 0; lx < coeff->filter_size; lx++)
-                {
-                    result += src_ptr[lx] * coeff_ptr[lx];
-                }
-                coeff_ptr += coeff->coeff_stride;
-                src_ptr += src_stride;
+                // First pixel of the unpadded source
+                const T* src_origin = srcps[f] + coeff->pad_top * src_stride + coeff->pad_left;
+                const float reach_x = (float)(1.0 / coeff->filter_step_x);
+                const float reach_y = (float)(1.0 / coeff->filter_step_y);
+
+                for (int x = 0; x < dst_width; x++)
+                    row[x] = limit_ringing(row[x], src_origin, src_stride, coeff->src_width, coeff->src_height,
+                        coeff->origin_x + x * coeff->step_x, coeff->origin_y + y * coeff->step_y, reach_x, reach_y, antiring, load);
             }
 
-            dstp[x] = clamp(result, -1.f, 1.f);
+            if (output.transfer != TransferType::None)
+            {
+                for (int x = 0; x < dst_width; x++)
+                    row[x] = from_linear(row[x], output.transfer);
+            }
 
-            meta++;
+            store_row(row, dstps[f] + static_cast<ptrdiff_t>(y) * dst_stride, dst_width, y, output, (*dither_states)[f]);
         }
-
-        dstp += dst_stride;
     }
 }
 
+/* Planar resampling with coeff table, one frame */
+template<typename T, typename U, typename Load>
+void resize_plane_c(EWAPixelCoeff* coeff, const T* srcp, U* JINC_RESTRICT dstp,
+    int dst_width, int dst_height, int src_stride, int dst_stride, const PlaneOutput& output, float antiring,
+    const Load& load)
+{
+    U* dst = dstp;
+    resize_planes_c(coeff, &srcp, &dst, 1, dst_width, dst_height, 0, dst_height, src_stride, dst_stride, output, antiring, load);
+}
+
 #if defined(USE_AVX2)
 /* Planar resampling with coeff table */
 /* 8-16 bit */
 /*template <typename T>
-static void resize_plane_avx2(EWAPixelCoeff* coeff, const T* srcp, T* VS_RESTRICT dstp,
+static void resize_plane_avx2(EWAPixelCoeff* coeff, const T* srcp, T* JINC_RESTRICT dstp,
     int dst_width, int dst_height, int src_stride, int dst_stride, int peak)
 {
     EWAPixelCoeffMeta* meta = coeff->meta.data();
@@ -325,15 +1204,15 @@ static void resize_plane_avx2(EWAPixelCoeff* coeff, const T* srcp, T* VS_RESTRIC
 
             float result = 0.f;
             auto rres = _mm256_setzero_ps();
-            for (int ly = 0; ly < coeff->filter_size; ly++)
+            for (int ly = 0; ly < coeff->filter_size_y; ly++)
             {
-                for (int lx = 0; lx < coeff->filter_size / 8; lx++)
+                for (int lx = 0; lx < coeff->filter_size_x / 8; lx++)
                 {
                     auto rsrc = _mm256_loadu_ps(reinterpret_cast<const float*>(src_ptr + lx * 8));
                     auto rcof = _mm256_load_ps(coeff_ptr + lx * 8);
                     rres = _mm256_fmadd_ps(rsrc, rcof, rres);
                 }
-                for (int lx = coeff->filter_size - coeff->filter_size % 8; lx < coeff->filter_size; ++lx)
+                for (int lx = coeff->filter_size_x - coeff->filter_size_x % 8; lx < coeff->filter_size_x; ++lx)
                 {
                     result += src_ptr[lx] * coeff_ptr[lx];
                 }
@@ -350,13 +1229,14 @@ static void resize_plane_avx2(EWAPixelCoeff* coeff, const T* srcp, T* VS_RESTRIC
 }*/
 
 /* Planar resampling with coeff table */
-/* 32 bit */
-static void resize_plane_avx2(EWAPixelCoeff* coeff, const float* srcp, float* VS_RESTRICT dstp,
-    int dst_width, int dst_height, int src_stride, int dst_stride)
+/* 32 bit, rows [row_begin, row_end), the table must not be symmetric */
+static void resize_plane_avx2(EWAPixelCoeff* coeff, const float* srcp, float* JINC_RESTRICT dstp,
+    int dst_width, int row_begin, int row_end, int src_stride, int dst_stride)
 {
-    EWAPixelCoeffMeta* meta = coeff->meta.data();
+    EWAPixelCoeffMeta* meta = coeff->meta.data() + static_cast<size_t>(row_begin) * dst_width;
+    dstp += static_cast<ptrdiff_t>(row_begin) * dst_stride;
 
-    for (int y = 0; y < dst_height; y++)
+    for (int y = row_begin; y < row_end; y++)
     {
         for (int x = 0; x < dst_width; x++)
         {
@@ -365,15 +1245,15 @@ static void resize_plane_avx2(EWAPixelCoeff* coeff, const float* srcp, float* VS
 
             float result = 0.f;
             auto rres = _mm256_setzero_ps();
-            for (int ly = 0; ly < coeff->filter_size; ly++)
+            for (int ly = 0; ly < coeff->filter_size_y; ly++)
             {
-                for (int lx = 0; lx < coeff->filter_size / 8; lx++)
+                for (int lx = 0; lx < coeff->filter_size_x / 8; lx++)
                 {
                     auto rsrc = _mm256_loadu_ps(src_ptr + lx * 8);
                     auto rcof = _mm256_load_ps(coeff_ptr + lx * 8);
                     rres = _mm256_fmadd_ps(rsrc, rcof, rres);
                 }
-                for (int lx = coeff->filter_size - coeff->filter_size % 8; lx < coeff->filter_size; ++lx)
+                for (int lx = coeff->filter_size_x - coeff->filter_size_x % 8; lx < coeff->filter_size_x; ++lx)
                 {
                     result += src_ptr[lx] * coeff_ptr[lx];
                 }
@@ -0,0 +1,121 @@
+/*
+*    Completed frames of batch mode:
+*      A batch of consecutive output frames is computed in one traversal of the
+*      coefficient tables, by the first thread that needs one of its frames.
+*      The other frames wait here until they are requested.
+*
+*      1.acquire():
+*          Take a completed frame, wait while another thread computes its batch,
+*          or claim the batch, then the caller computes it and calls complete()
+*      2.complete():
+*          Store the frames of a claimed batch and wake up the waiting threads
+*      3.Claim:
+*          Calls complete() for a claimed batch, without frames if the caller
+*          leaves early, e.g. on an exception, so the waiting threads never hang
+*/
+
+
+#ifndef FRAMECACHE_HPP_
+#define FRAMECACHE_HPP_
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "vapoursynth/VapourSynth.h"
+
+class FrameCache
+{
+public:
+    FrameCache(size_t capacity, const VSAPI* vsapi) : capacity(capacity), vsapi(vsapi) {}
+
+    ~FrameCache()
+    {
+        for (auto& entry : frames)
+            vsapi->freeFrame(entry.second);
+    }
+
+    /* Completed frame n, or nullptr once the caller has claimed batch first */
+    const VSFrameRef* acquire(int n, int first)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            for (auto it = frames.begin(); it != frames.end(); ++it)
+            {
+                if (it->first == n)
+                {
+                    const VSFrameRef* frame = it->second;
+                    frames.erase(it);
+                    return frame;
+                }
+            }
+
+            if (pending.count(first) == 0)
+            {
+                pending.insert(first);
+                return nullptr;
+            }
+
+            done.wait(lock);
+        }
+    }
+
+    void complete(int first, const std::vector<std::pair<int, const VSFrameRef*>>& batch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto& entry : batch)
+            {
+                frames.push_back(entry);
+                if (frames.size() > capacity)
+                {
+                    vsapi->freeFrame(frames.front().second);
+                    frames.pop_front();
+                }
+            }
+            pending.erase(first);
+        }
+        done.notify_all();
+    }
+
+    /* A claimed batch, cache may be nullptr when there is no batch mode */
+    class Claim
+    {
+    public:
+        Claim(FrameCache* cache, int first) : cache(cache), first(first) {}
+
+        ~Claim()
+        {
+            if (cache != nullptr)
+                cache->complete(first, {});
+        }
+
+        Claim(const Claim&) = delete;
+        Claim& operator=(const Claim&) = delete;
+
+        void complete(const std::vector<std::pair<int, const VSFrameRef*>>& batch)
+        {
+            if (cache != nullptr)
+                cache->complete(first, batch);
+            cache = nullptr;
+        }
+
+    private:
+        FrameCache* cache;
+        const int first;
+    };
+
+private:
+    const size_t capacity;
+    const VSAPI* vsapi;
+    std::mutex mutex;
+    std::condition_variable done;
+    std::set<int> pending;
+    std::list<std::pair<int, const VSFrameRef*>> frames;
+};
+
+#endif
@@ -11,6 +11,8 @@
 *          By Z boson
 *          Form https://stackoverflow.com/questions/13879609/horizontal-sum-of-8-packed-32bit-floats/18616679#18616679
 *          Called in EWAResizer.hpp
+*      4.JINC_RESTRICT:
+*          Restrict qualifier of the compiler, the engine doesn't depend on VSHelper.h
 */
 
 
@@ -25,13 +27,19 @@
 #include "immintrin.h"
 #endif
 
+#if defined(_MSC_VER)
+#define JINC_RESTRICT __restrict
+#else
+#define JINC_RESTRICT __restrict__
+#endif
+
 template <typename T>
 inline T clamp(T input, T range_min, T range_max)
 {
     return std::min(std::max(input, range_min), range_max);
 }
 
-double sample_sqr(double (*filter)(double), double x2, double blur2, double radius2)
+inline double sample_sqr(double (*filter)(double), double x2, double blur2, double radius2)
 {
     if (blur2 > 0.0)
         x2 /= blur2;
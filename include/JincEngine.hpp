@@ -0,0 +1,161 @@
+/*
+*    Resampling engine, independent of VapourSynth:
+*      1.Params:
+*          Geometry, formats and options of a resampler, the arguments of JincResize
+*      2.Resampler:
+*          Builds the coefficient tables once, then resamples frames given as plane
+*          pointers and strides owned by the caller. resize() doesn't modify the
+*          resampler, so any number of threads can call it at once.
+*      3.ParallelFor:
+*          Optional thread pool of the caller, the rows of a plane are split among
+*          its threads
+*
+*      Errors are thrown as std::string.
+*/
+
+
+#ifndef JINCENGINE_HPP_
+#define JINCENGINE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace jinc
+{
+
+enum class ColorFamily
+{
+    Gray,
+    RGB,
+    YUV
+};
+
+enum class SampleType
+{
+    Integer,
+    Float
+};
+
+enum class Dither
+{
+    None,
+    Ordered,
+    ErrorDiffusion
+};
+
+enum class Transfer
+{
+    None,
+    SRGB,
+    BT1886,
+    PQ
+};
+
+enum class Border
+{
+    Renormalize,
+    Replicate,
+    Mirror
+};
+
+enum class LogLevel
+{
+    Debug,
+    Warning
+};
+
+/* Integer RGB, and Gray with a transfer, is full range, other integer formats are limited range, float is taken as is */
+struct Format
+{
+    ColorFamily color_family = ColorFamily::Gray;
+    SampleType sample_type = SampleType::Integer;
+    int bits_per_sample = 8;                        // 8-16 for integer, 32 for float
+    int sub_sampling_w = 0, sub_sampling_h = 0;     // log2 of the chroma subsampling
+
+    int num_planes() const { return color_family == ColorFamily::Gray ? 1 : 3; }
+    int bytes_per_sample() const { return sample_type == SampleType::Float ? 4 : bits_per_sample > 8 ? 2 : 1; }
+};
+
+/* Source area, in pixels of the first plane */
+struct CropRect
+{
+    double left, top, width, height;
+
+    bool operator==(const CropRect& other) const
+    {
+        return left == other.left && top == other.top && width == other.width && height == other.height;
+    }
+};
+
+struct Params
+{
+    int src_width = 0, src_height = 0;
+    int dst_width = 0, dst_height = 0;
+    Format src_format;
+    Format dst_format;                              // same color family and subsampling as src_format
+
+    int tap = 3;                                    // 1-16
+    double blur = 0.9812505644269356;
+    CropRect crop{ 0.0, 0.0, 0.0, 0.0 };            // width / height of 0 are the source size
+    int quant_x = 0, quant_y = 0;                   // 0 is auto
+    Dither dither = Dither::None;
+    float antiring = 0.f;                           // 0.0-1.0
+    Transfer transfer = Transfer::None;             // RGB and Gray only
+    Border border = Border::Renormalize;
+    int64_t max_memory = 0;                         // budget of the coefficient tables in MB, 0 is unlimited
+    bool dynamic_crop = false;                      // frames may be resized with their own crop
+    bool planes[3] = { true, true, true };          // planes resampled, resize() doesn't touch the others
+};
+
+/* Planes of a frame, strides in bytes, planes that are not resampled may be nullptr */
+struct SourceFrame
+{
+    const void* data[3];
+    ptrdiff_t stride[3];
+};
+
+struct DestFrame
+{
+    void* data[3];
+    ptrdiff_t stride[3];
+};
+
+/* Most frames resampled in one traversal of the tables, resize() takes more in several traversals */
+constexpr int MAX_BATCH = 16;
+
+/* Calls task(0) ... task(count - 1), possibly concurrently, and returns once all of them are done */
+using ParallelFor = std::function<void(int count, const std::function<void(int)>& task)>;
+
+using LogFunction = std::function<void(LogLevel level, const std::string& message)>;
+
+class Resampler
+{
+public:
+    /* Builds the coefficient tables, log receives their size and the max_memory fallbacks */
+    explicit Resampler(const Params& params, const LogFunction& log = nullptr);
+    ~Resampler();
+
+    Resampler(const Resampler&) = delete;
+    Resampler& operator=(const Resampler&) = delete;
+
+    /* Params with the defaults resolved and the max_memory fallbacks applied */
+    const Params& params() const;
+
+    /* Memory of the coefficient tables of one crop, in bytes */
+    size_t table_size() const;
+
+    /* Resample frames frames, with the crop of params, or crops[f] for frame f if dynamic_crop is set */
+    void resize(const SourceFrame* srcs, const DestFrame* dsts, int frames = 1, const CropRect* crops = nullptr,
+        const ParallelFor& parallel = nullptr) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+}
+
+#endif
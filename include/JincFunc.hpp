@@ -23,7 +23,7 @@ constexpr double M_PI = 3.14159265358979323846;
 #endif
 
 // Taylor series coefficients of 2*BesselJ1(pi*x)/(pi*x) as (x^2) -> 0
-double jinc_taylor_series[31] =
+inline const double jinc_taylor_series[31] =
 {
      1.0,
     -1.23370055013616982735431137,
@@ -58,7 +58,7 @@ double jinc_taylor_series[31] =
      2.68232117541264485328658605e-55
 };
 
-double jinc_zeros[16] =
+inline const double jinc_zeros[16] =
 {
     1.2196698912665045,
     2.2331305943815286,
@@ -84,7 +84,7 @@ double jinc_zeros[16] =
 //  Use, modification and distribution are subject to the
 //  Boost Software License, Version 1.0. (See accompanying file
 //  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
-double evaluate_rational(const double* num, const double* denom, double z, int count)
+inline double evaluate_rational(const double* num, const double* denom, double z, int count)
 {
     double s1, s2;
     if (z <= 1.0)
@@ -122,7 +122,7 @@ double evaluate_rational(const double* num, const double* denom, double z, int c
 //  Use, modification and distribution are subject to the
 //  Boost Software License, Version 1.0. (See accompanying file
 //  LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
-double jinc_sqr_boost_l(double x2)
+inline double jinc_sqr_boost_l(double x2)
 {
     static const double bPC[7] =
     {
@@ -179,7 +179,7 @@ double jinc_sqr_boost_l(double x2)
 }
 
 // jinc(sqrt(x2))
-double jinc_sqr(double x2)
+inline double jinc_sqr(double x2)
 {
     if (x2 < 1.49)        // the 1-tap radius
     {
@@ -23,7 +23,7 @@ private:
     int lut_size = 1024;
 };
 
-Lut::Lut()
+inline Lut::Lut()
 {
 #if defined(USE_AVX2)
     lut = (double*)_mm_malloc(sizeof(double) * lut_size, 64);
@@ -32,7 +32,7 @@ Lut::Lut()
 #endif
 }
 
-void Lut::InitLut(int lut_size, double radius, double blur)
+inline void Lut::InitLut(int lut_size, double radius, double blur)
 {
     this->lut_size = lut_size;
     auto radius2 = radius * radius;
@@ -67,7 +67,7 @@ void Lut::InitLut(int lut_size, double radius, double blur)
 #endif
 }
 
-void Lut::DestroyLutTable()
+inline void Lut::DestroyLutTable()
 {
 #if defined(USE_AVX2)
     _mm_free(lut);
@@ -76,7 +76,7 @@ void Lut::DestroyLutTable()
 #endif
 }
 
-float Lut::GetFactor(int index)
+inline float Lut::GetFactor(int index)
 {
     if (index >= lut_size)
         return 0.f;
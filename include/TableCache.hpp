@@ -0,0 +1,90 @@
+/*
+*    Coefficient tables of per-frame geometries (dynamic crop):
+*      1.CropRect:
+*          src_left / src_top / src_width / src_height of one frame, declared in JincEngine.hpp
+*      2.CoeffTables:
+*          Tables of the luma and the chroma planes for one CropRect
+*      3.TableCache:
+*          Bounded LRU cache of CoeffTables, shared by the threads of a filter instance
+*          Missing tables are built outside of the lock, from the phase kernels of
+*          the most recently used tables when they are compatible
+*/
+
+
+#ifndef TABLECACHE_HPP_
+#define TABLECACHE_HPP_
+
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "EWAResizer.hpp"
+#include "JincEngine.hpp"
+
+using jinc::CropRect;
+
+struct CoeffTables
+{
+    CropRect crop;
+    std::shared_ptr<EWAPixelCoeff> luma;      // nullptr if plane 0 is not resampled
+    std::shared_ptr<EWAPixelCoeff> chroma;    // nullptr for single plane formats or if U and V are not resampled
+};
+
+class TableCache
+{
+public:
+    explicit TableCache(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    void insert(std::shared_ptr<const CoeffTables> tables)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert_locked(std::move(tables));
+    }
+
+    /* Tables of crop, built by build(crop, reuse) on a miss, reuse may be nullptr */
+    template<typename Build>
+    std::shared_ptr<const CoeffTables> get(const CropRect& crop, Build build)
+    {
+        std::shared_ptr<const CoeffTables> reuse;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if ((*it)->crop == crop)
+                {
+                    entries.splice(entries.begin(), entries, it);
+                    return entries.front();
+                }
+            }
+            if (!entries.empty())
+                reuse = entries.front();
+        }
+
+        // Tables are immutable once built, so reuse can be read while other threads resample with it
+        std::shared_ptr<const CoeffTables> tables = build(crop, reuse.get());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& entry : entries)
+        {
+            // Another thread built the same geometry meanwhile
+            if (entry->crop == crop)
+                return entry;
+        }
+        insert_locked(tables);
+        return tables;
+    }
+
+private:
+    void insert_locked(std::shared_ptr<const CoeffTables> tables)
+    {
+        entries.push_front(std::move(tables));
+        if (entries.size() > capacity)
+            entries.pop_back();
+    }
+
+    const size_t capacity;
+    std::mutex mutex;
+    std::list<std::shared_ptr<const CoeffTables>> entries;
+};
+
+#endif
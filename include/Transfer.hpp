@@ -0,0 +1,78 @@
+/*
+*    Transfer functions for linear light resampling:
+*      1.to_linear():
+*          Convert a normalized non-linear value to linear light (EOTF)
+*          Used to build the per-code lut of integer input in JincResize.cpp
+*      2.from_linear():
+*          Inverse of to_linear(), applied to each row of results
+*          Called in EWAResizer.hpp
+*
+*    Linear light is normalized so that 1.0 is the nominal peak,
+*    for PQ it corresponds to 10000 cd/m^2.
+*/
+
+
+#ifndef TRANSFER_HPP_
+#define TRANSFER_HPP_
+
+#include <cmath>
+#include <algorithm>
+
+enum class TransferType
+{
+    None,
+    SRGB,
+    BT1886,
+    PQ
+};
+
+namespace pq
+{
+    constexpr double m1 = 2610.0 / 16384.0;
+    constexpr double m2 = 2523.0 / 4096.0 * 128.0;
+    constexpr double c1 = 3424.0 / 4096.0;
+    constexpr double c2 = 2413.0 / 4096.0 * 32.0;
+    constexpr double c3 = 2392.0 / 4096.0 * 32.0;
+}
+
+inline double to_linear(double value, TransferType transfer)
+{
+    value = std::max(value, 0.0);
+
+    switch (transfer)
+    {
+    case TransferType::SRGB:
+        return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+    case TransferType::BT1886:
+        return std::pow(value, 2.4);
+    case TransferType::PQ:
+    {
+        const double e = std::pow(std::min(value, 1.0), 1.0 / pq::m2);
+        return std::pow(std::max(e - pq::c1, 0.0) / (pq::c2 - pq::c3 * e), 1.0 / pq::m1);
+    }
+    default:
+        return value;
+    }
+}
+
+inline float from_linear(float value, TransferType transfer)
+{
+    value = std::max(value, 0.f);
+
+    switch (transfer)
+    {
+    case TransferType::SRGB:
+        return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+    case TransferType::BT1886:
+        return std::pow(value, 1.f / 2.4f);
+    case TransferType::PQ:
+    {
+        const float y = std::pow(std::min(value, 1.f), (float)pq::m1);
+        return std::pow(((float)pq::c1 + (float)pq::c2 * y) / (1.f + (float)pq::c3 * y), (float)pq::m2);
+    }
+    default:
+        return value;
+    }
+}
+
+#endif
@@ -0,0 +1,620 @@
+#include <algorithm>
+#include <string>
+#include <memory>
+
+#include "../include/JincEngine.hpp"
+#include "../include/EWAResizer.hpp"
+#include "../include/TableCache.hpp"
+
+namespace jinc
+{
+
+static_assert(MAX_BATCH == ::MAX_BATCH, "MAX_BATCH of the API and of the kernels must match");
+
+// Rows of a plane resampled by one task of a ParallelFor
+constexpr int STRIPE_ROWS = 32;
+
+struct EngineData
+{
+    Params params;
+    PlaneOutput output[3];
+    TransferType transfer = TransferType::None;
+    std::vector<float> linear_lut;
+    std::unique_ptr<Lut> init_lut;
+
+    // Table parameters not part of Params
+    int samples = 1024;
+    double radius = 0.0;
+    bool on_the_fly = false;
+    size_t table_size = 0;
+
+    // Tables of the crop of params
+    std::shared_ptr<const CoeffTables> tables;
+
+    // Tables of recent per-frame crops, with dynamic_crop
+    std::unique_ptr<TableCache> table_cache;
+};
+
+struct Resampler::Impl : EngineData {};
+
+static DitherType to_dither_type(Dither dither)
+{
+    switch (dither)
+    {
+    case Dither::Ordered:
+        return DitherType::Ordered;
+    case Dither::ErrorDiffusion:
+        return DitherType::ErrorDiffusion;
+    default:
+        return DitherType::None;
+    }
+}
+
+static TransferType to_transfer_type(Transfer transfer)
+{
+    switch (transfer)
+    {
+    case Transfer::SRGB:
+        return TransferType::SRGB;
+    case Transfer::BT1886:
+        return TransferType::BT1886;
+    case Transfer::PQ:
+        return TransferType::PQ;
+    default:
+        return TransferType::None;
+    }
+}
+
+static BorderMode to_border_mode(Border border)
+{
+    switch (border)
+    {
+    case Border::Replicate:
+        return BorderMode::Replicate;
+    case Border::Mirror:
+        return BorderMode::Mirror;
+    default:
+        return BorderMode::Renormalize;
+    }
+}
+
+static bool supported_format(const Format& format)
+{
+    if (format.sample_type == SampleType::Integer)
+        return format.bits_per_sample >= 8 && format.bits_per_sample <= 16;
+    return format.bits_per_sample == 32;
+}
+
+/* Normalized value of a sample: norm = value * gain + bias */
+/* Integer RGB, and Gray with a transfer, is full range, other integer formats are limited range, float is taken as is */
+static void sample_normalization(const Format& format, int plane, TransferType transfer, double* gain, double* bias)
+{
+    if (format.sample_type == SampleType::Float)
+    {
+        *gain = 1.0;
+        *bias = 0.0;
+        return;
+    }
+
+    const int shift = format.bits_per_sample - 8;
+
+    if (format.color_family == ColorFamily::RGB || (format.color_family == ColorFamily::Gray && transfer != TransferType::None))
+    {
+        *gain = 1.0 / ((1 << format.bits_per_sample) - 1);
+        *bias = 0.0;
+    }
+    else if (plane == 0)
+    {
+        *gain = 1.0 / (219 << shift);
+        *bias = -(16 << shift) * *gain;
+    }
+    else
+    {
+        *gain = 1.0 / (224 << shift);
+        *bias = -(128 << shift) * *gain;
+    }
+}
+
+static PlaneOutput make_plane_output(const Format& in_format, const Format& out_format, int plane, DitherType dither,
+    TransferType transfer)
+{
+    double in_gain, in_bias, out_gain, out_bias;
+    sample_normalization(in_format, plane, transfer, &in_gain, &in_bias);
+    sample_normalization(out_format, plane, transfer, &out_gain, &out_bias);
+
+    // In linear light the accumulator is already normalized
+    if (transfer != TransferType::None)
+    {
+        in_gain = 1.0;
+        in_bias = 0.0;
+    }
+
+    PlaneOutput output;
+    output.scale = static_cast<float>(in_gain / out_gain);
+    output.offset = static_cast<float>((in_bias - out_bias) / out_gain);
+    output.transfer = transfer;
+
+    if (out_format.sample_type == SampleType::Integer)
+    {
+        output.lower = 0.f;
+        output.upper = static_cast<float>((1 << out_format.bits_per_sample) - 1);
+        output.dither = dither;
+    }
+    else
+    {
+        output.lower = -1.f;
+        output.upper = 1.f;
+    }
+
+    return output;
+}
+
+/* Set up the tables of tables->crop, separable with dynamic_crop so a new crop is cheap to build */
+static void init_tables(const EngineData* d, CoeffTables* tables)
+{
+    const Params& p = d->params;
+    const CropRect& crop = tables->crop;
+    const BorderMode border = to_border_mode(p.border);
+
+    if (tables->luma)
+        init_coeff_table(tables->luma.get(), d->init_lut.get(), p.quant_x, p.quant_y, d->samples, p.src_width, p.src_height,
+            p.dst_width, p.dst_height, d->radius, crop.left, crop.top, crop.width, crop.height, border, d->on_the_fly, p.dynamic_crop);
+
+    // U and V have the same geometry, so they share one table
+    if (tables->chroma)
+    {
+        const int sub_w = p.src_format.sub_sampling_w;
+        const int sub_h = p.src_format.sub_sampling_h;
+        const double div_w = static_cast<double>(1 << sub_w);
+        const double div_h = static_cast<double>(1 << sub_h);
+
+        init_coeff_table(tables->chroma.get(), d->init_lut.get(), p.quant_x, p.quant_y, d->samples, p.src_width >> sub_w, p.src_height >> sub_h,
+            p.dst_width >> sub_w, p.dst_height >> sub_h, d->radius, crop.left / div_w, crop.top / div_h, crop.width / div_w, crop.height / div_h,
+            border, d->on_the_fly, p.dynamic_crop);
+    }
+}
+
+static std::shared_ptr<CoeffTables> new_tables(const EngineData* d, const CropRect& crop)
+{
+    auto tables = std::make_shared<CoeffTables>();
+    tables->crop = crop;
+    // Planes that are not resampled have no table
+    const bool* planes = d->params.planes;
+    if (planes[0])
+        tables->luma = std::make_shared<EWAPixelCoeff>();
+    if (d->params.src_format.num_planes() > 1 && (planes[1] || planes[2]))
+        tables->chroma = std::make_shared<EWAPixelCoeff>();
+    return tables;
+}
+
+/* Tables of a per-frame crop, the phase kernels of reuse are copied when compatible */
+static std::shared_ptr<const CoeffTables> build_tables(const EngineData* d, const CropRect& crop, const CoeffTables* reuse)
+{
+    std::shared_ptr<CoeffTables> tables = new_tables(d, crop);
+    init_tables(d, tables.get());
+
+    if (tables->luma)
+        build_coeff_table(tables->luma.get(), reuse ? reuse->luma.get() : nullptr);
+    if (tables->chroma)
+        build_coeff_table(tables->chroma.get(), reuse ? reuse->chroma.get() : nullptr);
+
+    return tables;
+}
+
+static std::shared_ptr<const CoeffTables> frame_tables(const EngineData* d, const CropRect& crop)
+{
+    if (crop == d->tables->crop)
+        return d->tables;
+
+    if (!(crop.width > 0.0 && crop.height > 0.0))
+        throw std::string{ "src_width and src_height of a frame must be positive" };
+
+    return d->table_cache->get(crop, [d](const CropRect& crop, const CoeffTables* reuse)
+        {
+            return build_tables(d, crop, reuse);
+        });
+}
+
+/* Runs the tasks through parallel, or in order on the calling thread */
+static void run_tasks(const ParallelFor& parallel, int count, const std::function<void(int)>& task)
+{
+    if (parallel && count > 1)
+    {
+        parallel(count, task);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        task(i);
+}
+
+template<typename U>
+static void resize_planes(EWAPixelCoeff* coeff, const float* const* srcps, U* const* dstps, int frames, int row_begin, int row_end,
+    int src_stride, int dst_stride, const EngineData* const JINC_RESTRICT d, int plane, std::vector<DitherState>* dither_states) noexcept
+{
+#if defined(USE_AVX2)
+    if constexpr (std::is_same<U, float>::value)
+    {
+        if (frames == 1 && d->output[plane].scale == 1.f && d->output[plane].offset == 0.f && d->params.antiring == 0.f &&
+            d->transfer == TransferType::None && uses_meta(coeff) && coeff->constant_phase < 0 && !coeff->symmetric)
+        {
+            resize_plane_avx2(coeff, srcps[0], dstps[0], coeff->dst_width, row_begin, row_end, src_stride, dst_stride);
+            return;
+        }
+    }
+#endif
+    resize_planes_c(coeff, srcps, dstps, frames, coeff->dst_width, coeff->dst_height, row_begin, row_end, src_stride, dst_stride,
+        d->output[plane], d->params.antiring, DirectLoad<float>{}, dither_states);
+}
+
+/* Resample frames frames sharing tables, in one traversal of the tables */
+template<typename T, typename U>
+static void process(const SourceFrame* srcs, const DestFrame* dsts, int frames, const EngineData* const JINC_RESTRICT d,
+    const CoeffTables* tables, const ParallelFor& parallel)
+{
+    const int num_planes = d->params.src_format.num_planes();
+
+    // The kernels write the frames of a batch with one stride
+    for (int f = 1; f < frames; f++)
+    {
+        for (int plane = 0; plane < num_planes; plane++)
+        {
+            if (d->params.planes[plane] && dsts[f].stride[plane] != dsts[0].stride[plane])
+            {
+                for (int g = 0; g < frames; g++)
+                    process<T, U>(srcs + g, dsts + g, 1, d, tables, parallel);
+                return;
+            }
+        }
+    }
+
+    const float* srcps[MAX_BATCH];
+    U* dstps[MAX_BATCH];
+
+    for (int plane = 0; plane < num_planes; plane++)
+    {
+        if (!d->params.planes[plane])
+            continue;
+
+        EWAPixelCoeff* coeff = plane == 0 ? tables->luma.get() : tables->chroma.get();
+
+        const int dst_stride = static_cast<int>(dsts[0].stride[plane] / static_cast<ptrdiff_t>(sizeof(U)));
+        const int dst_height = coeff->dst_height;
+
+        for (int f = 0; f < frames; f++)
+            dstps[f] = static_cast<U*>(dsts[f].data[plane]);
+
+        int src_stride = 0;
+        bool in_place = false;
+
+        // Float input without padding or transfer is resampled in place
+        if constexpr (std::is_floating_point<T>::value)
+        {
+            if (coeff->border == BorderMode::Renormalize && d->transfer == TransferType::None)
+            {
+                in_place = true;
+                for (int f = 0; f < frames; f++)
+                {
+                    srcps[f] = static_cast<const T*>(srcs[f].data[plane]);
+                    in_place = in_place && srcs[f].stride[plane] == srcs[0].stride[plane];
+                }
+                src_stride = static_cast<int>(srcs[0].stride[plane] / static_cast<ptrdiff_t>(sizeof(T)));
+            }
+        }
+
+        // Otherwise each stripe converts the source rows it reads to float, padded and in linear light if needed,
+        // so the kernels don't convert each sample for every window covering it, and only a few rows are held per task
+        const int scratch_stride = coeff->src_width + coeff->pad_left + coeff->pad_right;
+
+        auto convert_rows = [&](int f, int row_begin, int row_end, float* dstp)
+        {
+            const T* srcp = static_cast<const T*>(srcs[f].data[plane]);
+            const int stride = static_cast<int>(srcs[f].stride[plane] / static_cast<ptrdiff_t>(sizeof(T)));
+
+            if constexpr (std::is_integral<T>::value)
+            {
+                if (d->transfer != TransferType::None)
+                    pad_rows(coeff, srcp, stride, dstp, scratch_stride, row_begin, row_end, LutLoad<T>{ d->linear_lut.data() });
+                else
+                    pad_rows(coeff, srcp, stride, dstp, scratch_stride, row_begin, row_end, DirectLoad<T>{});
+            }
+            else
+            {
+                if (d->transfer != TransferType::None)
+                    pad_rows(coeff, srcp, stride, dstp, scratch_stride, row_begin, row_end, TransferLoad{ d->transfer });
+                else
+                    pad_rows(coeff, srcp, stride, dstp, scratch_stride, row_begin, row_end, DirectLoad<T>{});
+            }
+        };
+
+        // Output rows [row_begin, row_end), scratch receives the converted source rows of the frames
+        auto resample_rows = [&](int row_begin, int row_end, std::vector<float>& scratch, std::vector<DitherState>* dither_states)
+        {
+            const float* rows_srcps[MAX_BATCH];
+            int rows_stride = src_stride;
+
+            if (in_place)
+            {
+                std::copy(srcps, srcps + frames, rows_srcps);
+            }
+            else
+            {
+                int first, last;
+                source_rows(coeff, row_begin, row_end, d->params.antiring > 0.f, &first, &last);
+
+                const size_t frame_size = static_cast<size_t>(last - first) * scratch_stride;
+                if (scratch.size() < frame_size * frames)
+                    scratch.resize(frame_size * frames);
+
+                for (int f = 0; f < frames; f++)
+                {
+                    float* rows = scratch.data() + f * frame_size;
+                    convert_rows(f, first, last, rows);
+                    // The kernels address rows from the top of the padded plane, only rows [first, last) are read
+                    rows_srcps[f] = rows - static_cast<ptrdiff_t>(first + coeff->pad_top) * scratch_stride;
+                }
+                rows_stride = scratch_stride;
+            }
+
+            resize_planes(coeff, rows_srcps, dstps, frames, row_begin, row_end, rows_stride, dst_stride, d, plane, dither_states);
+        };
+
+        const int stripes = (dst_height + STRIPE_ROWS - 1) / STRIPE_ROWS;
+
+        // Error diffusion carries its error from row to row, so such a plane stays in one task that runs its stripes in order
+        if (parallel && d->output[plane].dither != DitherType::ErrorDiffusion)
+        {
+            run_tasks(parallel, stripes, [&](int stripe)
+                {
+                    std::vector<float> scratch;
+                    resample_rows(stripe * STRIPE_ROWS, std::min((stripe + 1) * STRIPE_ROWS, dst_height), scratch, nullptr);
+                });
+        }
+        else
+        {
+            std::vector<float> scratch;
+            std::vector<DitherState> dither_states(frames, DitherState(coeff->dst_width, d->output[plane].dither));
+            for (int stripe = 0; stripe < stripes; stripe++)
+                resample_rows(stripe * STRIPE_ROWS, std::min((stripe + 1) * STRIPE_ROWS, dst_height), scratch, &dither_states);
+        }
+    }
+}
+
+template<typename T>
+static void process_to(const SourceFrame* srcs, const DestFrame* dsts, int frames, const EngineData* const JINC_RESTRICT d,
+    const CoeffTables* tables, const ParallelFor& parallel)
+{
+    if (d->params.dst_format.sample_type == SampleType::Float)
+        process<T, float>(srcs, dsts, frames, d, tables, parallel);
+    else if (d->params.dst_format.bytes_per_sample() == 2)
+        process<T, uint16_t>(srcs, dsts, frames, d, tables, parallel);
+    else
+        process<T, uint8_t>(srcs, dsts, frames, d, tables, parallel);
+}
+
+Resampler::Resampler(const Params& params, const LogFunction& log) : impl(std::make_unique<Impl>())
+{
+    EngineData* d = impl.get();
+    Params& p = d->params;
+    p = params;
+
+    if (p.src_width <= 0 || p.src_height <= 0 || p.dst_width <= 0 || p.dst_height <= 0)
+        throw std::string{ "source and output size must be positive" };
+
+    if (!supported_format(p.src_format))
+        throw std::string{ "only 8-16 bit integer and 32 bits float input supported" };
+    if (p.dst_format.color_family != p.src_format.color_family ||
+        p.dst_format.sub_sampling_w != p.src_format.sub_sampling_w ||
+        p.dst_format.sub_sampling_h != p.src_format.sub_sampling_h)
+        throw std::string{ "output format must have the same color family and subsampling as input" };
+    if (!supported_format(p.dst_format))
+        throw std::string{ "only 8-16 bit integer and 32 bits float output supported" };
+
+    d->transfer = to_transfer_type(p.transfer);
+    if (d->transfer != TransferType::None && p.src_format.color_family == ColorFamily::YUV)
+        throw std::string{ "linear light resampling requires RGB or Gray input" };
+
+    // Integer samples are linearized through a per-code lut in the kernel
+    if (d->transfer != TransferType::None && p.src_format.sample_type == SampleType::Integer)
+    {
+        double gain, bias;
+        sample_normalization(p.src_format, 0, d->transfer, &gain, &bias);
+
+        d->linear_lut.resize(static_cast<size_t>(1) << p.src_format.bits_per_sample);
+        for (size_t i = 0; i < d->linear_lut.size(); i++)
+            d->linear_lut[i] = static_cast<float>(to_linear(i * gain + bias, d->transfer));
+    }
+
+    for (int plane = 0; plane < p.src_format.num_planes(); plane++)
+        d->output[plane] = make_plane_output(p.src_format, p.dst_format, plane, to_dither_type(p.dither), d->transfer);
+
+    bool any_plane = false;
+    for (int plane = 0; plane < p.src_format.num_planes(); plane++)
+        any_plane = any_plane || p.planes[plane];
+    if (!any_plane)
+        throw std::string{ "at least one plane must be resampled" };
+
+    if (p.tap < 1 || p.tap > 16)
+        throw std::string{ "tap must be in the range of 1-16" };
+
+    if (p.antiring < 0.f || p.antiring > 1.f)
+        throw std::string{ "antiring must be in the range of 0.0-1.0" };
+
+    if (p.quant_x < 0 || p.quant_y < 0)
+        throw std::string{ "quant_x and quant_y must be 0 (auto) or positive" };
+
+    if (p.max_memory < 0)
+        throw std::string{ "max_memory must be 0 (unlimited) or positive" };
+
+    if (p.crop.width == 0.0)
+        p.crop.width = static_cast<double>(p.src_width);
+    if (p.crop.height == 0.0)
+        p.crop.height = static_cast<double>(p.src_height);
+
+    // Tables of per-frame crops share their phase kernels only at a fixed quantization
+    if (p.dynamic_crop)
+    {
+        if (p.quant_x == 0)
+            p.quant_x = 256;
+        if (p.quant_y == 0)
+            p.quant_y = 256;
+    }
+
+    d->samples = 1024;  // should be a multiple of 4
+    d->radius = jinc_zeros[p.tap - 1];
+    d->init_lut = std::make_unique<Lut>();
+    d->init_lut->InitLut(d->samples, d->radius, p.blur);
+
+    std::shared_ptr<CoeffTables> tables = new_tables(d, p.crop);
+    // Set up the tables and return the memory they will take
+    auto plan_tables = [&]()
+    {
+        init_tables(d, tables.get());
+        size_t size = 0;
+        if (tables->luma)
+            size += plan_coeff_table(tables->luma.get());
+        if (tables->chroma)
+            size += plan_coeff_table(tables->chroma.get());
+        return size;
+    };
+
+    auto log_size = [&](LogLevel level, const std::string& reason, size_t size)
+    {
+        if (log)
+            log(level, reason + ", coefficient tables take " + std::to_string((size + (1 << 20) - 1) >> 20) + " MB");
+    };
+
+    size_t table_size = plan_tables();
+    log_size(LogLevel::Debug, "planned", table_size);
+
+    if (p.max_memory > 0)
+    {
+        const size_t budget = static_cast<size_t>(p.max_memory) << 20;
+
+        const EWAPixelCoeff* first = tables->luma ? tables->luma.get() : tables->chroma.get();
+        const int requested_x = p.quant_x, requested_y = p.quant_y;
+        const int finest_x = first->quantize_x, finest_y = first->quantize_y;
+
+        // 1. Padded border, border pixels use the kernels of the interior
+        if (table_size > budget && p.border == Border::Renormalize)
+        {
+            p.border = Border::Replicate;
+            table_size = plan_tables();
+            log_size(LogLevel::Warning, "max_memory exceeded, border switched to \"replicate\"", table_size);
+        }
+
+        // 2. Coarser quantization, fewer distinct kernels, while a halving saves an eighth or brings the tables in budget
+        while (table_size > budget && (first->quantize_x > 16 || first->quantize_y > 16))
+        {
+            const int last_x = first->quantize_x, last_y = first->quantize_y;
+            p.quant_x = std::max(last_x / 2, std::min(last_x, 16));
+            p.quant_y = std::max(last_y / 2, std::min(last_y, 16));
+
+            const size_t size = plan_tables();
+            if (size > budget && size > table_size - table_size / 8)
+            {
+                p.quant_x = last_x;
+                p.quant_y = last_y;
+                table_size = plan_tables();
+                break;
+            }
+
+            table_size = size;
+        }
+
+        // 3. No per-pixel table, windows are located while resampling
+        if (table_size > budget)
+        {
+            d->on_the_fly = true;
+            table_size = plan_tables();
+            log_size(LogLevel::Warning, "max_memory exceeded, coefficients are located on the fly", table_size);
+        }
+
+        // The later fallbacks may have freed room, go back to the finest quantization that fits
+        while (first->quantize_x < finest_x || first->quantize_y < finest_y)
+        {
+            const int last_x = first->quantize_x, last_y = first->quantize_y;
+            const bool finest = std::min(last_x * 2, finest_x) == finest_x && std::min(last_y * 2, finest_y) == finest_y;
+            p.quant_x = finest ? requested_x : std::min(last_x * 2, finest_x);
+            p.quant_y = finest ? requested_y : std::min(last_y * 2, finest_y);
+
+            const size_t size = plan_tables();
+            if (size > budget)
+            {
+                p.quant_x = last_x;
+                p.quant_y = last_y;
+                table_size = plan_tables();
+                break;
+            }
+
+            table_size = size;
+        }
+
+        if (first->quantize_x < finest_x || first->quantize_y < finest_y)
+            log_size(LogLevel::Warning, "max_memory exceeded, quant_x / quant_y lowered to " + std::to_string(p.quant_x) +
+                " / " + std::to_string(p.quant_y), table_size);
+
+        if (table_size > budget)
+            log_size(LogLevel::Warning, "max_memory can't be met", table_size);
+    }
+
+    if (tables->luma)
+        build_coeff_table(tables->luma.get());
+    if (tables->chroma)
+        build_coeff_table(tables->chroma.get());
+    d->tables = tables;
+    d->table_size = table_size;
+
+    if (p.dynamic_crop)
+    {
+        // Up to 8 geometries, fewer if they wouldn't fit in max_memory
+        size_t capacity = 8;
+        if (p.max_memory > 0)
+            capacity = std::min<size_t>(capacity, (static_cast<size_t>(p.max_memory) << 20) / std::max<size_t>(table_size, 1));
+
+        d->table_cache = std::make_unique<TableCache>(capacity);
+        d->table_cache->insert(d->tables);
+    }
+}
+
+Resampler::~Resampler() = default;
+
+const Params& Resampler::params() const
+{
+    return impl->params;
+}
+
+size_t Resampler::table_size() const
+{
+    return impl->table_size;
+}
+
+void Resampler::resize(const SourceFrame* srcs, const DestFrame* dsts, int frames, const CropRect* crops,
+    const ParallelFor& parallel) const
+{
+    const EngineData* d = impl.get();
+
+    if (crops != nullptr && !d->params.dynamic_crop)
+        throw std::string{ "per-frame crops require dynamic_crop" };
+
+    std::vector<std::shared_ptr<const CoeffTables>> tables(frames);
+    for (int f = 0; f < frames; f++)
+        tables[f] = crops != nullptr ? frame_tables(d, crops[f]) : d->tables;
+
+    // Frames sharing tables are resampled together
+    for (int f = 0, run = 1; f < frames; f += run)
+    {
+        run = 1;
+        while (f + run < frames && run < MAX_BATCH && tables[f + run] == tables[f])
+            run++;
+
+        if (d->params.src_format.sample_type == SampleType::Float)
+            process_to<float>(srcs + f, dsts + f, run, d, tables[f].get(), parallel);
+        else if (d->params.src_format.bytes_per_sample() == 2)
+            process_to<uint16_t>(srcs + f, dsts + f, run, d, tables[f].get(), parallel);
+        else
+            process_to<uint8_t>(srcs + f, dsts + f, run, d, tables[f].get(), parallel);
+    }
+}
+
+}
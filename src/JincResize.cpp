@@ -1,7 +1,14 @@
+#include <algorithm>
+#include <exception>
 #include <string>
 #include <memory>
+#include <vector>
 
-#include "../include/EWAResizer.hpp"
+#include "vapoursynth/VapourSynth.h"
+#include "vapoursynth/VSHelper.h"
+
+#include "../include/JincEngine.hpp"
+#include "../include/FrameCache.hpp"
 
 struct VSNodeDeleter
 {
@@ -21,12 +28,21 @@ struct FilterData
     explicit FilterData(const VSAPI* vsapi) : node(nullptr, VSNodeDeleter{ vsapi }) {}
     std::unique_ptr<VSNodeRef, VSNodeDeleter> node;
     const VSVideoInfo* vi = nullptr;
+    const VSFormat* out_format = nullptr;
     int w = 0, h = 0;
-    int peak = 0;
-    Lut* init_lut;
-    std::unique_ptr<EWAPixelCoeff> out_y;
-    std::unique_ptr<EWAPixelCoeff> out_u;
-    std::unique_ptr<EWAPixelCoeff> out_v;
+
+    std::unique_ptr<jinc::Resampler> resampler;
+
+    // Planes that are not resampled are copied by reference from the source if it has the same size and format,
+    // otherwise they are filled
+    bool passthrough = false;
+
+    // Crop read from frame props
+    bool dynamic_crop = false;
+
+    // Consecutive frames resampled together, the ones not requested yet wait in frame_cache
+    int batch = 1;
+    std::unique_ptr<FrameCache> frame_cache;
 };
 
 // Doesn't double precision overkill?
@@ -35,86 +51,199 @@ static void VS_CC filterInit(VSMap* in, VSMap* out, void** instanceData, VSNode*
 {
     FilterData* d = static_cast<FilterData*>(*instanceData);
     VSVideoInfo new_vi = (VSVideoInfo) * (d->vi);
+    new_vi.format = d->out_format;
     new_vi.width = d->w;
     new_vi.height = d->h;
     vsapi->setVideoInfo(&new_vi, 1, node);
 }
 
-template<typename T>
-static void process_uint(const VSFrameRef* src, VSFrameRef* dst, const FilterData* const VS_RESTRICT d, const VSAPI* vsapi) noexcept
+static jinc::Format engine_format(const VSFormat* format)
 {
-    for (int plane = 0; plane < d->vi->format->numPlanes; plane++)
-    {
-        const T* srcp = reinterpret_cast<const T*>(vsapi->getReadPtr(src, plane));
-        T* VS_RESTRICT dstp = reinterpret_cast<T*>(vsapi->getWritePtr(dst, plane));
-        int src_stride = vsapi->getStride(src, plane) / sizeof(T);
-        int dst_stride = vsapi->getStride(dst, plane) / sizeof(T);
-
-        int dst_width = vsapi->getFrameWidth(dst, plane);
-        int dst_height = vsapi->getFrameHeight(dst, plane);
-
-        if (plane == 0)
-            resize_plane_c(d->out_y.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride, d->peak);
-        else if (plane == 1)
-            resize_plane_c(d->out_u.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride, d->peak);
-        else if (plane == 2)
-            resize_plane_c(d->out_v.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride, d->peak);
-    }
+    jinc::Format out;
+    out.color_family = format->colorFamily == cmGray ? jinc::ColorFamily::Gray :
+        format->colorFamily == cmRGB ? jinc::ColorFamily::RGB : jinc::ColorFamily::YUV;
+    out.sample_type = format->sampleType == stFloat ? jinc::SampleType::Float : jinc::SampleType::Integer;
+    out.bits_per_sample = format->bitsPerSample;
+    out.sub_sampling_w = format->subSamplingW;
+    out.sub_sampling_h = format->subSamplingH;
+    return out;
+}
+
+/* Crop value from frame props, int or float, fallback if not set */
+static double frame_crop(const VSMap* props, const char* key, double fallback, const VSAPI* vsapi)
+{
+    int err;
+    const double value = vsapi->propGetFloat(props, key, 0, &err);
+    if (!err)
+        return value;
+    if (err == peType)
+        return static_cast<double>(vsapi->propGetInt(props, key, 0, &err));
+    return fallback;
 }
 
-static void process_float(const VSFrameRef* src, VSFrameRef* dst, const FilterData* const VS_RESTRICT d, const VSAPI* vsapi) noexcept
+/* Plane that is not resampled and can't be copied: black, chroma neutral */
+static void fill_plane(VSFrameRef* frame, int plane, const VSAPI* vsapi)
 {
-    for (int plane = 0; plane < d->vi->format->numPlanes; plane++)
+    const VSFormat* format = vsapi->getFrameFormat(frame);
+    const int width = vsapi->getFrameWidth(frame, plane);
+    const int height = vsapi->getFrameHeight(frame, plane);
+    const int stride = vsapi->getStride(frame, plane);
+    uint8_t* dstp = vsapi->getWritePtr(frame, plane);
+
+    const bool chroma = plane > 0 && format->colorFamily != cmRGB;
+
+    for (int y = 0; y < height; y++)
     {
-        const float* srcp = reinterpret_cast<const float*>(vsapi->getReadPtr(src, plane));
-        float* VS_RESTRICT dstp = reinterpret_cast<float*>(vsapi->getWritePtr(dst, plane));
-        int src_stride = vsapi->getStride(src, plane) / sizeof(float);
-        int dst_stride = vsapi->getStride(dst, plane) / sizeof(float);
-
-        int dst_width = vsapi->getFrameWidth(dst, plane);
-        int dst_height = vsapi->getFrameHeight(dst, plane);
-
-#if defined(USE_AVX2)
-        if (plane == 0)
-            resize_plane_avx2(d->out_y.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-        else if (plane == 1)
-            resize_plane_avx2(d->out_u.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-        else if (plane == 2)
-             resize_plane_avx2(d->out_v.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-#else
-        if (plane == 0)
-            resize_plane_c(d->out_y.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-        else if (plane == 1)
-            resize_plane_c(d->out_u.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-        else if (plane == 2)
-            resize_plane_c(d->out_v.get(), srcp, dstp, dst_width, dst_height, src_stride, dst_stride);
-#endif
+        if (format->sampleType == stFloat)
+        {
+            std::fill_n(reinterpret_cast<float*>(dstp), width, 0.f);
+        }
+        else
+        {
+            const int shift = format->bitsPerSample - 8;
+            const int value = chroma ? 128 << shift : format->colorFamily == cmRGB ? 0 : 16 << shift;
+
+            if (format->bytesPerSample == 1)
+                std::fill_n(dstp, width, static_cast<uint8_t>(value));
+            else
+                std::fill_n(reinterpret_cast<uint16_t*>(dstp), width, static_cast<uint16_t>(value));
+        }
+        dstp += stride;
     }
 }
 
+/* Last frame of the batch beginning at first */
+static int batch_last(const FilterData* d, int first)
+{
+    int last = first + d->batch - 1;
+    if (d->vi->numFrames > 0)
+        last = std::min(last, d->vi->numFrames - 1);
+    return last;
+}
+
 static const VSFrameRef* VS_CC filterGetFrame(int n, int activationReason, void** instanceData,
     void** frameData, VSFrameContext* frameCtx, VSCore* core, const VSAPI* vsapi)
 {
     const FilterData* d = static_cast<const FilterData*>(*instanceData);
 
+    const int first = n - n % d->batch;
+    const int last = batch_last(d, first);
+
     if (activationReason == arInitial)
     {
-        vsapi->requestFrameFilter(n, d->node.get(), frameCtx);
+        for (int i = first; i <= last; i++)
+            vsapi->requestFrameFilter(i, d->node.get(), frameCtx);
     }
     else if (activationReason == arAllFramesReady)
     {
-        const VSFrameRef* src = vsapi->getFrameFilter(n, d->node.get(), frameCtx);
-        VSFrameRef* dst = vsapi->newVideoFrame(d->vi->format, d->w, d->h, src, core);
+        if (d->batch > 1)
+        {
+            // Computed along with an earlier frame of the batch, or claim the batch
+            const VSFrameRef* done = d->frame_cache->acquire(n, first);
+            if (done != nullptr)
+                return done;
+        }
 
-        if (d->vi->format->bytesPerSample == 1)
-            process_uint<uint8_t>(src, dst, d, vsapi);
-        else if (d->vi->format->bytesPerSample == 2)
-            process_uint<uint16_t>(src, dst, d, vsapi);
-        else
-            process_float(src, dst, d, vsapi);
+        // Released by the destructor if this returns without completing the batch
+        FrameCache::Claim claim(d->frame_cache.get(), first);
+
+        const int frames = last - first + 1;
+        std::vector<const VSFrameRef*> srcs(frames);
+        std::vector<VSFrameRef*> dsts(frames);
+        std::vector<jinc::SourceFrame> src_planes(frames);
+        std::vector<jinc::DestFrame> dst_planes(frames);
+        std::vector<jinc::CropRect> crops(frames, d->resampler->params().crop);
+        const bool* process = d->resampler->params().planes;
 
-        vsapi->freeFrame(src);
-        return dst;
+        for (int f = 0; f < frames; f++)
+        {
+            srcs[f] = vsapi->getFrameFilter(first + f, d->node.get(), frameCtx);
+
+            if (d->passthrough)
+            {
+                const VSFrameRef* plane_src[3] = { nullptr, nullptr, nullptr };
+                const int planes[3] = { 0, 1, 2 };
+                for (int plane = 0; plane < d->vi->format->numPlanes; plane++)
+                {
+                    if (!process[plane])
+                        plane_src[plane] = srcs[f];
+                }
+                dsts[f] = vsapi->newVideoFrame2(d->out_format, d->w, d->h, plane_src, planes, srcs[f], core);
+            }
+            else
+            {
+                dsts[f] = vsapi->newVideoFrame(d->out_format, d->w, d->h, srcs[f], core);
+            }
+
+            src_planes[f] = jinc::SourceFrame{};
+            dst_planes[f] = jinc::DestFrame{};
+            for (int plane = 0; plane < d->vi->format->numPlanes; plane++)
+            {
+                if (!process[plane])
+                {
+                    if (!d->passthrough)
+                        fill_plane(dsts[f], plane, vsapi);
+                    continue;
+                }
+
+                src_planes[f].data[plane] = vsapi->getReadPtr(srcs[f], plane);
+                src_planes[f].stride[plane] = vsapi->getStride(srcs[f], plane);
+                dst_planes[f].data[plane] = vsapi->getWritePtr(dsts[f], plane);
+                dst_planes[f].stride[plane] = vsapi->getStride(dsts[f], plane);
+            }
+
+            if (d->dynamic_crop)
+            {
+                const VSMap* props = vsapi->getFramePropsRO(srcs[f]);
+                crops[f] = jinc::CropRect{
+                    frame_crop(props, "src_left", crops[f].left, vsapi),
+                    frame_crop(props, "src_top", crops[f].top, vsapi),
+                    frame_crop(props, "src_width", crops[f].width, vsapi),
+                    frame_crop(props, "src_height", crops[f].height, vsapi) };
+            }
+        }
+
+        auto fail = [&](const std::string& error)
+        {
+            for (int f = 0; f < frames; f++)
+            {
+                vsapi->freeFrame(srcs[f]);
+                vsapi->freeFrame(dsts[f]);
+            }
+
+            vsapi->setFilterError(("JincResize: " + error).c_str(), frameCtx);
+        };
+
+        try
+        {
+            d->resampler->resize(src_planes.data(), dst_planes.data(), frames, d->dynamic_crop ? crops.data() : nullptr);
+        }
+        catch (const std::string & error)
+        {
+            fail(error);
+            return 0;
+        }
+        catch (const std::exception & error)
+        {
+            fail(error.what());
+            return 0;
+        }
+
+        for (int f = 0; f < frames; f++)
+            vsapi->freeFrame(srcs[f]);
+
+        if (d->batch > 1)
+        {
+            std::vector<std::pair<int, const VSFrameRef*>> others;
+            for (int f = 0; f < frames; f++)
+            {
+                if (first + f != n)
+                    others.emplace_back(first + f, dsts[f]);
+            }
+            claim.complete(others);
+        }
+
+        return dsts[n - first];
     }
 
     return 0;
@@ -123,7 +252,6 @@ static const VSFrameRef* VS_CC filterGetFrame(int n, int activationReason, void*
 static void VS_CC filterFree(void* instanceData, VSCore* core, const VSAPI* vsapi)
 {
     FilterData* d = static_cast<FilterData*>(instanceData);
-    delete d->init_lut;
     delete d;
 }
 
@@ -137,9 +265,6 @@ static void VS_CC filterCreate(const VSMap* in, VSMap* out, void* userData, VSCo
     d->w = int64ToIntS(vsapi->propGetInt(in, "width", 0, &err));
     d->h = int64ToIntS(vsapi->propGetInt(in, "height", 0, &err));
 
-    if (d->vi->format->bytesPerSample <= 2)
-        d->peak = (1 << d->vi->format->bitsPerSample) - 1;
-
     //probably add an RGB check because subpixel shifting is :effort:
     try
     {
@@ -148,65 +273,142 @@ static void VS_CC filterCreate(const VSMap* in, VSMap* out, void* userData, VSCo
             (d->vi->format->sampleType == stFloat && d->vi->format->bitsPerSample != 32))
             throw std::string{ "only constant format 8-16 bit integer and 32 bits float input supported" };
 
-        int tap = int64ToIntS(vsapi->propGetInt(in, "tap", 0, &err));
-        if (err)
-            tap = 3;
+        jinc::Params params;
+        params.src_width = d->vi->width;
+        params.src_height = d->vi->height;
+        params.dst_width = d->w;
+        params.dst_height = d->h;
+
+        d->out_format = d->vi->format;
+        int out_format_id = int64ToIntS(vsapi->propGetInt(in, "format", 0, &err));
+        if (!err)
+        {
+            d->out_format = vsapi->getFormatPreset(out_format_id, core);
+
+            if (d->out_format == nullptr)
+                throw std::string{ "invalid output format" };
+        }
+
+        params.src_format = engine_format(d->vi->format);
+        params.dst_format = engine_format(d->out_format);
+
+        const int num_planes = vsapi->propNumElements(in, "planes");
+        if (num_planes > 0)
+        {
+            for (int plane = 0; plane < 3; plane++)
+                params.planes[plane] = false;
+
+            for (int i = 0; i < num_planes; i++)
+            {
+                const int plane = int64ToIntS(vsapi->propGetInt(in, "planes", i, 0));
+                if (plane < 0 || plane >= d->vi->format->numPlanes)
+                    throw std::string{ "plane index out of range" };
+                if (params.planes[plane])
+                    throw std::string{ "plane specified twice" };
+                params.planes[plane] = true;
+            }
+        }
 
-        if (tap < 1 || tap > 16)
-            throw std::string{ "tap must be in the range of 1-16" };
+        d->passthrough = d->out_format == d->vi->format && d->w == d->vi->width && d->h == d->vi->height;
 
-        double radius = jinc_zeros[tap - 1];
+        const char* dither_type = vsapi->propGetData(in, "dither_type", 0, &err);
+        if (!err)
+        {
+            const std::string dither_name{ dither_type };
+            if (dither_name == "ordered")
+                params.dither = jinc::Dither::Ordered;
+            else if (dither_name == "error_diffusion")
+                params.dither = jinc::Dither::ErrorDiffusion;
+            else if (dither_name != "none")
+                throw std::string{ "dither_type must be \"none\", \"ordered\" or \"error_diffusion\"" };
+        }
 
-        double blur = vsapi->propGetFloat(in, "blur", 0, &err);
+        const char* transfer = vsapi->propGetData(in, "transfer", 0, &err);
+        if (!err)
+        {
+            const std::string transfer_name{ transfer };
+            if (transfer_name == "srgb")
+                params.transfer = jinc::Transfer::SRGB;
+            else if (transfer_name == "1886")
+                params.transfer = jinc::Transfer::BT1886;
+            else if (transfer_name == "st2084")
+                params.transfer = jinc::Transfer::PQ;
+            else if (transfer_name != "none")
+                throw std::string{ "transfer must be \"none\", \"srgb\", \"1886\" or \"st2084\"" };
+        }
+
+        params.tap = int64ToIntS(vsapi->propGetInt(in, "tap", 0, &err));
         if (err)
-            blur = 0.9812505644269356;
+            params.tap = 3;
 
-        double crop_left = vsapi->propGetFloat(in, "src_left", 0, &err);
+        params.blur = vsapi->propGetFloat(in, "blur", 0, &err);
         if (err)
-            crop_left = 0.0;
+            params.blur = 0.9812505644269356;
 
-        double crop_top = vsapi->propGetFloat(in, "src_top", 0, &err);
+        params.crop.left = vsapi->propGetFloat(in, "src_left", 0, &err);
         if (err)
-            crop_top = 0.0;
+            params.crop.left = 0.0;
 
-        double crop_width = vsapi->propGetFloat(in, "src_width", 0, &err);
+        params.crop.top = vsapi->propGetFloat(in, "src_top", 0, &err);
         if (err)
-            crop_width = static_cast<double>(d->vi->width);
+            params.crop.top = 0.0;
 
-        double crop_height = vsapi->propGetFloat(in, "src_height", 0, &err);
+        params.crop.width = vsapi->propGetFloat(in, "src_width", 0, &err);
         if (err)
-            crop_height = static_cast<double>(d->vi->height);
+            params.crop.width = static_cast<double>(d->vi->width);
 
-        int samples = 1024;  // should be a multiple of 4
+        params.crop.height = vsapi->propGetFloat(in, "src_height", 0, &err);
+        if (err)
+            params.crop.height = static_cast<double>(d->vi->height);
 
-        int quantize_x = int64ToIntS(vsapi->propGetInt(in, "quant_x", 0, &err));
+        params.antiring = static_cast<float>(vsapi->propGetFloat(in, "antiring", 0, &err));
         if (err)
-            quantize_x = 256;
-        int quantize_y = int64ToIntS(vsapi->propGetInt(in, "quant_y", 0, &err));
+            params.antiring = 0.f;
+
+        const char* border_name = vsapi->propGetData(in, "border", 0, &err);
+        if (!err)
+        {
+            const std::string name{ border_name };
+            if (name == "replicate")
+                params.border = jinc::Border::Replicate;
+            else if (name == "mirror")
+                params.border = jinc::Border::Mirror;
+            else if (name != "renormalize")
+                throw std::string{ "border must be \"renormalize\", \"replicate\" or \"mirror\"" };
+        }
+
+        // 0 is auto: the exact denominator of the scale ratio, up to 256
+        params.quant_x = int64ToIntS(vsapi->propGetInt(in, "quant_x", 0, &err));
+        if (err)
+            params.quant_x = 0;
+        params.quant_y = int64ToIntS(vsapi->propGetInt(in, "quant_y", 0, &err));
         if (err)
-            quantize_y = 256;
+            params.quant_y = 0;
 
-        d->init_lut = new Lut();
-        d->init_lut->InitLut(samples, radius, blur);
-        d->out_y = std::make_unique<EWAPixelCoeff>();
+        d->dynamic_crop = !!vsapi->propGetInt(in, "dynamic_crop", 0, &err);
+        params.dynamic_crop = d->dynamic_crop;
+
+        // Budget of the coefficient tables in MB, 0 is unlimited
+        params.max_memory = vsapi->propGetInt(in, "max_memory", 0, &err);
+
+        d->resampler = std::make_unique<jinc::Resampler>(params, [vsapi](jinc::LogLevel level, const std::string& message)
+            {
+                vsapi->logMessage(level == jinc::LogLevel::Debug ? mtDebug : mtWarning, ("JincResize: " + message).c_str());
+            });
+
+        d->batch = int64ToIntS(vsapi->propGetInt(in, "batch", 0, &err));
+        if (err)
+            d->batch = 1;
 
-        generate_coeff_table_c(d->init_lut, d->out_y.get(), quantize_x, quantize_y, samples, d->vi->width, d->vi->height,
-            d->w, d->h, radius, crop_left, crop_top, crop_width, crop_height);
+        if (d->batch < 1 || d->batch > jinc::MAX_BATCH)
+            throw std::string{ "batch must be in the range of 1-" + std::to_string(jinc::MAX_BATCH) };
 
-        if (d->vi->format->numPlanes > 1)
+        // Every thread can hold a claimed batch whose other frames wait until they are requested
+        if (d->batch > 1)
         {
-            d->out_u = std::make_unique<EWAPixelCoeff>();
-            d->out_v = std::make_unique<EWAPixelCoeff>();
-
-            int sub_w = d->vi->format->subSamplingW;
-            int sub_h = d->vi->format->subSamplingH;
-            double div_w = static_cast<double>(1 << sub_w);
-            double div_h = static_cast<double>(1 << sub_h);
-
-            generate_coeff_table_c(d->init_lut, d->out_u.get(), quantize_x, quantize_y, samples, d->vi->width >> sub_w, d->vi->height >> sub_h,
-                d->w >> sub_w, d->h >> sub_h, radius, crop_left / div_w, crop_top / div_h, crop_width / div_w, crop_height / div_h);
-            generate_coeff_table_c(d->init_lut, d->out_v.get(), quantize_x, quantize_y, samples, d->vi->width >> sub_w, d->vi->height >> sub_h,
-                d->w >> sub_w, d->h >> sub_h, radius, crop_left / div_w, crop_top / div_h, crop_width / div_w, crop_height / div_h);
+            VSCoreInfo info;
+            vsapi->getCoreInfo2(core, &info);
+            d->frame_cache = std::make_unique<FrameCache>(static_cast<size_t>(d->batch) * std::max(info.numThreads * 2, 4), vsapi);
         }
     }
     catch (const std::string & error)
@@ -233,6 +435,15 @@ VS_EXTERNAL_API(void) VapourSynthPluginInit(VSConfigPlugin configFunc, VSRegiste
         "src_height:float:opt;"
         "quant_x:int:opt;"
         "quant_y:int:opt;"
-        "blur:float:opt",
+        "blur:float:opt;"
+        "format:int:opt;"
+        "dither_type:data:opt;"
+        "antiring:float:opt;"
+        "transfer:data:opt;"
+        "border:data:opt;"
+        "max_memory:int:opt;"
+        "dynamic_crop:int:opt;"
+        "batch:int:opt;"
+        "planes:int[]:opt",
         filterCreate, 0, plugin);
 }